@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2024-2025 Oxoboo
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE
+ * AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stddef.h>
+#include "SDL_cpuinfo.h"
+#include "batch.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BATCH_X86
+#include <immintrin.h>
+/* the kernels are compiled for their instruction sets, and only called if the CPU has them */
+#if defined(__GNUC__)
+#define BATCH_TARGET(isa) __attribute__((target(isa)))
+#else
+#define BATCH_TARGET(isa)
+#endif
+#endif
+
+/*
+ * The kernels count the cells that only a line piece can fill like count_col_line_dep_cells in
+ * bot.c, but with bit operations on the column words:
+ * + The first row from the top where both neighbours are filled is the lowest set bit `top` of
+ *   their AND (of the right neighbour alone for the leftmost column).
+ * + The gap starts two rows under it, so the filled cells of the column there are
+ *   `col & ~((top << 2) - 1)`, and the gap ends at the lowest of them or at the bottom.
+ * With no `top`, or a gap that ends before it starts, there are no such cells.
+ */
+static void batch_run_scalar(batch_t* batch) {
+    for (uint32_t lane = 0; lane < batch->size; ++lane) {
+        uint32_t holes = 0;
+        uint32_t sum = 0;
+        uint32_t sum_squares = 0;
+        uint32_t stack_height = 0;
+        uint32_t line_dep_cells = 0;
+        for (uint32_t c = 0; c < batch->cols; ++c) {
+            uint32_t height = batch->heights[c][lane];
+            holes += height - batch->col_counts[c][lane];
+            sum += height;
+            sum_squares += height * height;
+            stack_height = height > stack_height ? height : stack_height;
+        }
+        for (uint32_t c = 0; c + 1 < batch->cols; ++c) {
+            uint32_t both = batch->col_bits[c + 1][lane];
+            if (c > 0) {
+                both &= batch->col_bits[c - 1][lane];
+            }
+            uint32_t top = both & (0u - both);
+            if (top == 0) {
+                continue;
+            }
+            uint32_t below = batch->col_bits[c][lane] & ~((top << 2) - 1);
+            uint32_t start = MATRIX_LOWEST_BIT(top) + 2;
+            uint32_t end = below != 0 ? MATRIX_LOWEST_BIT(below) : batch->rows;
+            line_dep_cells += end > start ? end - start : 0;
+        }
+        batch->holes[lane] = holes;
+        batch->line_dep_cells[lane] = line_dep_cells;
+        batch->stack_height[lane] = stack_height;
+        batch->sums[lane] = sum;
+        batch->sum_squares[lane] = sum_squares;
+    }
+}
+
+#if defined(BATCH_X86)
+
+/* Like MATRIX_LOWEST_BIT: a power of two converts to a float exactly, with the bit as exponent. */
+BATCH_TARGET("sse2")
+static __m128i batch_bit_index_sse2(__m128i bit) {
+    __m128i exponent = _mm_srli_epi32(_mm_castps_si128(_mm_cvtepi32_ps(bit)), 23);
+    return _mm_sub_epi32(_mm_and_si128(exponent, _mm_set1_epi32(0xFF)), _mm_set1_epi32(127));
+}
+
+#define BATCH_LOAD_SSE2(array, c, lane) _mm_loadu_si128((const __m128i*)&(array)[c][lane])
+
+/* batch_run_scalar for 4 boards at a time. */
+BATCH_TARGET("sse2")
+static void batch_run_sse2(batch_t* batch) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i two = _mm_set1_epi32(2);
+    const __m128i rows = _mm_set1_epi32(batch->rows);
+    for (uint32_t lane = 0; lane < batch->size; lane += 4) {
+        __m128i holes = zero;
+        __m128i sum = zero;
+        __m128i sum_squares = zero;
+        __m128i stack_height = zero;
+        __m128i line_dep_cells = zero;
+        for (uint32_t c = 0; c < batch->cols; ++c) {
+            __m128i height = BATCH_LOAD_SSE2(batch->heights, c, lane);
+            holes = _mm_add_epi32(holes, _mm_sub_epi32(height,
+                                                       BATCH_LOAD_SSE2(batch->col_counts, c, lane)));
+            sum = _mm_add_epi32(sum, height);
+            /* heights fit in the low 16 bits of each word, which is all madd and max look at */
+            sum_squares = _mm_add_epi32(sum_squares, _mm_madd_epi16(height, height));
+            stack_height = _mm_max_epi16(stack_height, height);
+        }
+        for (uint32_t c = 0; c + 1 < batch->cols; ++c) {
+            __m128i both = BATCH_LOAD_SSE2(batch->col_bits, c + 1, lane);
+            if (c > 0) {
+                both = _mm_and_si128(both, BATCH_LOAD_SSE2(batch->col_bits, c - 1, lane));
+            }
+            __m128i top = _mm_and_si128(both, _mm_sub_epi32(zero, both));
+            __m128i below = _mm_andnot_si128(_mm_sub_epi32(_mm_slli_epi32(top, 2), one),
+                                             BATCH_LOAD_SSE2(batch->col_bits, c, lane));
+            __m128i start = _mm_add_epi32(batch_bit_index_sse2(top), two);
+            __m128i no_below = _mm_cmpeq_epi32(below, zero);
+            __m128i end = batch_bit_index_sse2(_mm_and_si128(below, _mm_sub_epi32(zero, below)));
+            end = _mm_or_si128(_mm_and_si128(no_below, rows), _mm_andnot_si128(no_below, end));
+            __m128i cells = _mm_sub_epi32(end, start);
+            cells = _mm_and_si128(cells, _mm_cmpgt_epi32(cells, zero));
+            cells = _mm_andnot_si128(_mm_cmpeq_epi32(top, zero), cells);
+            line_dep_cells = _mm_add_epi32(line_dep_cells, cells);
+        }
+        _mm_storeu_si128((__m128i*)&batch->holes[lane], holes);
+        _mm_storeu_si128((__m128i*)&batch->line_dep_cells[lane], line_dep_cells);
+        _mm_storeu_si128((__m128i*)&batch->stack_height[lane], stack_height);
+        _mm_storeu_si128((__m128i*)&batch->sums[lane], sum);
+        _mm_storeu_si128((__m128i*)&batch->sum_squares[lane], sum_squares);
+    }
+}
+
+BATCH_TARGET("avx2")
+static __m256i batch_bit_index_avx2(__m256i bit) {
+    __m256i exponent = _mm256_srli_epi32(_mm256_castps_si256(_mm256_cvtepi32_ps(bit)), 23);
+    return _mm256_sub_epi32(_mm256_and_si256(exponent, _mm256_set1_epi32(0xFF)),
+                            _mm256_set1_epi32(127));
+}
+
+#define BATCH_LOAD_AVX2(array, c, lane) _mm256_loadu_si256((const __m256i*)&(array)[c][lane])
+
+/* batch_run_scalar for 8 boards at a time. */
+BATCH_TARGET("avx2")
+static void batch_run_avx2(batch_t* batch) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i two = _mm256_set1_epi32(2);
+    const __m256i rows = _mm256_set1_epi32(batch->rows);
+    for (uint32_t lane = 0; lane < batch->size; lane += 8) {
+        __m256i holes = zero;
+        __m256i sum = zero;
+        __m256i sum_squares = zero;
+        __m256i stack_height = zero;
+        __m256i line_dep_cells = zero;
+        for (uint32_t c = 0; c < batch->cols; ++c) {
+            __m256i height = BATCH_LOAD_AVX2(batch->heights, c, lane);
+            holes = _mm256_add_epi32(holes, _mm256_sub_epi32(
+                                                height, BATCH_LOAD_AVX2(batch->col_counts, c, lane)));
+            sum = _mm256_add_epi32(sum, height);
+            sum_squares = _mm256_add_epi32(sum_squares, _mm256_mullo_epi32(height, height));
+            stack_height = _mm256_max_epi32(stack_height, height);
+        }
+        for (uint32_t c = 0; c + 1 < batch->cols; ++c) {
+            __m256i both = BATCH_LOAD_AVX2(batch->col_bits, c + 1, lane);
+            if (c > 0) {
+                both = _mm256_and_si256(both, BATCH_LOAD_AVX2(batch->col_bits, c - 1, lane));
+            }
+            __m256i top = _mm256_and_si256(both, _mm256_sub_epi32(zero, both));
+            __m256i below = _mm256_andnot_si256(_mm256_sub_epi32(_mm256_slli_epi32(top, 2), one),
+                                                BATCH_LOAD_AVX2(batch->col_bits, c, lane));
+            __m256i start = _mm256_add_epi32(batch_bit_index_avx2(top), two);
+            __m256i no_below = _mm256_cmpeq_epi32(below, zero);
+            __m256i end = batch_bit_index_avx2(_mm256_and_si256(below,
+                                                                _mm256_sub_epi32(zero, below)));
+            end = _mm256_blendv_epi8(end, rows, no_below);
+            __m256i cells = _mm256_max_epi32(_mm256_sub_epi32(end, start), zero);
+            cells = _mm256_andnot_si256(_mm256_cmpeq_epi32(top, zero), cells);
+            line_dep_cells = _mm256_add_epi32(line_dep_cells, cells);
+        }
+        _mm256_storeu_si256((__m256i*)&batch->holes[lane], holes);
+        _mm256_storeu_si256((__m256i*)&batch->line_dep_cells[lane], line_dep_cells);
+        _mm256_storeu_si256((__m256i*)&batch->stack_height[lane], stack_height);
+        _mm256_storeu_si256((__m256i*)&batch->sums[lane], sum);
+        _mm256_storeu_si256((__m256i*)&batch->sum_squares[lane], sum_squares);
+    }
+}
+
+#endif
+
+/*
+ * Use kernel `kind` (BATCH_SCALAR, BATCH_SSE2 or BATCH_AVX2) to evaluate the batch. Return
+ * whether this CPU can run it; if not, the kernel is left as it was.
+ */
+bool batch_set_kernel(batch_t* batch, uint32_t kind) {
+    batch_kernel_t kernel = NULL;
+    if (kind == BATCH_SCALAR) {
+        kernel = batch_run_scalar;
+    }
+#if defined(BATCH_X86)
+    if (kind == BATCH_SSE2 && SDL_HasSSE2()) {
+        kernel = batch_run_sse2;
+    } else if (kind == BATCH_AVX2 && SDL_HasAVX2()) {
+        kernel = batch_run_avx2;
+    }
+#endif
+    if (!kernel) {
+        return false;
+    }
+    batch->kernel = kernel;
+    batch->kernel_kind = kind;
+    return true;
+}
+
+/*
+ * Set up an empty batch for matrices with the same dimensions as `matrix`, with the widest kernel
+ * that this CPU can run.
+ */
+void batch_init(batch_t* batch, const matrix_t* matrix) {
+    batch->size = 0;
+    batch->rows = matrix->rows;
+    batch->cols = matrix->cols;
+    /* the vector kernels read whole vectors, so every lane must hold something */
+    for (size_t c = 0; c < MATRIX_MAX_COLS; ++c) {
+        for (size_t lane = 0; lane < BATCH_MAX; ++lane) {
+            batch->col_bits[c][lane] = 0;
+            batch->heights[c][lane] = 0;
+            batch->col_counts[c][lane] = 0;
+        }
+    }
+    if (!batch_set_kernel(batch, BATCH_AVX2) && !batch_set_kernel(batch, BATCH_SSE2)) {
+        batch_set_kernel(batch, BATCH_SCALAR);
+    }
+}
+
+/* Copy the column words of a matrix into the next lane of the batch. The batch must not be full. */
+void batch_add(batch_t* batch, const matrix_t* matrix) {
+    uint32_t lane = batch->size;
+    for (uint32_t c = 0; c < batch->cols; ++c) {
+        batch->col_bits[c][lane] = matrix->col_bits[c];
+        batch->heights[c][lane] = matrix_col_height(matrix, c);
+        batch->col_counts[c][lane] = matrix_col_count(matrix, c);
+    }
+    ++batch->size;
+}
+
+/*
+ * Evaluate every matrix added since the last run and empty the batch. The features of the matrix
+ * in lane `i` are then in element `i` of the output arrays until the next run.
+ */
+void batch_run(batch_t* batch) {
+    batch->kernel(batch);
+    for (uint32_t lane = 0; lane < batch->size; ++lane) {
+        int64_t sum = batch->sums[lane];
+        batch->spread[lane] = batch->cols * (int64_t)batch->sum_squares[lane] - sum * sum;
+        batch->in_rightmost_col[lane] = batch->cols > 0 ? batch->col_counts[batch->cols - 1][lane]
+                                                        : 0;
+    }
+    batch->size = 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2024-2025 Oxoboo
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE
+ * AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "matrix.h"
+
+/*
+ * Boards are evaluated BATCH_MAX at a time in structure-of-arrays form: each column of every
+ * board is one 32-bit word with bit `r` set if row `r` is filled, and word `lane` of each array
+ * belongs to board `lane`. The SIMD kernels then work on 4 (SSE2) or 8 (AVX2) boards per
+ * instruction.
+ */
+enum {
+    BATCH_MAX = 16,
+};
+
+enum {
+    BATCH_SCALAR,
+    BATCH_SSE2,
+    BATCH_AVX2,
+    NUM_BATCH_KERNELS,
+};
+
+typedef struct batch batch_t;
+
+typedef void (*batch_kernel_t)(batch_t* batch);
+
+struct batch {
+    /* input, see batch_add */
+    uint32_t col_bits[MATRIX_MAX_COLS][BATCH_MAX];
+    uint32_t heights[MATRIX_MAX_COLS][BATCH_MAX];
+    uint32_t col_counts[MATRIX_MAX_COLS][BATCH_MAX];
+    uint32_t size;
+    uint32_t rows;
+    uint32_t cols;
+    /* output, the same features as bot_evaluate */
+    uint32_t holes[BATCH_MAX];
+    uint32_t line_dep_cells[BATCH_MAX];
+    uint32_t in_rightmost_col[BATCH_MAX];
+    uint32_t stack_height[BATCH_MAX];
+    int64_t spread[BATCH_MAX];
+    uint32_t sums[BATCH_MAX];
+    uint32_t sum_squares[BATCH_MAX];
+    batch_kernel_t kernel;
+    uint32_t kernel_kind;
+};
+
+void batch_init(batch_t* batch, const matrix_t* matrix);
+bool batch_set_kernel(batch_t* batch, uint32_t kind);
+void batch_add(batch_t* batch, const matrix_t* matrix);
+void batch_run(batch_t* batch);
+
+#endif /* BATCH_H */
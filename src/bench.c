@@ -0,0 +1,968 @@
+/*
+ * Copyright (c) 2024-2025 Oxoboo
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE
+ * AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SDL_atomic.h"
+#include "SDL_cpuinfo.h"
+#include "SDL_stdinc.h"
+#include "SDL_timer.h"
+#include "matrix.h"
+#include "movegen.h"
+#include "bot.h"
+#include "surface.h"
+#include "bench.h"
+#include "errorvalues.h"
+
+/*
+ * Whether /b also times the fill kernels of fill.c, which the screensaver does not use. Build
+ * with `make BENCH_FILL=1` to link them in.
+ */
+#ifndef BENCH_FILL
+#define BENCH_FILL 0
+#endif
+#if BENCH_FILL
+#include "fill.h"
+#endif
+
+enum {
+    BENCH_SEED = 1,
+    BENCH_BOARDS = 256,
+    BENCH_ROUNDS = 20,
+    BENCH_PIECES = 300,
+    BENCH_THREADS = 3,
+    BENCH_SURFACE_ENTRIES = 4096, /* signatures of the surface table checked by bench_surface */
+};
+
+/* lookahead settings compared by bench_search: depth, beam width, budget in microseconds */
+static const uint32_t bench_search_settings[][3] = {
+    { 1, 1, 0 },
+    { 2, 4, 1000 },
+    { 3, 4, 2000 },
+    { 4, 4, 5000 },
+    { 4, 8, 20000 },
+};
+
+/* SDL's allocator and the calls made to it, see bench_allocations */
+static SDL_malloc_func bench_real_malloc;
+static SDL_calloc_func bench_real_calloc;
+static SDL_realloc_func bench_real_realloc;
+static SDL_free_func bench_real_free;
+static SDL_atomic_t bench_num_mallocs;
+static SDL_atomic_t bench_num_reallocs;
+static SDL_atomic_t bench_num_frees;
+
+static double bench_seconds(uint64_t start) {
+    return (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+}
+
+/*
+ * Fill `boards` with positions to run the benchmarks on. Half of them come from the bot playing
+ * normally and half from pieces dropped at random, which leaves holes and overhangs. Return 0 on
+ * success or a non-zero value on failure.
+ */
+static int32_t bench_boards(matrix_t* boards, uint32_t num_boards) {
+    matrix_t* matrix = matrix_new(MATRIX_ROWS, MATRIX_COLS, MATRIX_HIDDEN_ROWS);
+    if (!matrix) {
+        return ERROR_MATRIX;
+    }
+    bot_t* bot = bot_new(matrix);
+    if (!bot) {
+        matrix_free(matrix);
+        return ERROR_BOT;
+    }
+    int32_t err_value = 0;
+    piece_t piece;
+    for (uint32_t i = 0; i < num_boards && err_value == 0; ++i) {
+        if (i % 2 == 0) {
+            err_value = bot_next_piece(bot, matrix, &piece);
+            piece.orient_index = bot->dest_orient_index;
+            piece.x = bot->dest_x;
+            piece.y = bot->dest_y;
+        } else {
+            piece_init(&piece, matrix, rand() % NUM_PIECES + 1);
+            piece.orient_index = rand() % piece.orientations;
+            piece.x = rand() % matrix->cols - 1;
+            if (!piece_collides(&piece, matrix)) {
+                piece_hard_drop(&piece, matrix);
+            }
+        }
+        if (err_value != 0 || piece_collides(&piece, matrix)) {
+            matrix_clear(matrix);
+        } else {
+            piece_place(&piece, matrix);
+            matrix_clean(matrix, NULL);
+        }
+        matrix_init(&boards[i], matrix->rows, matrix->cols, matrix->hidden_rows);
+        matrix_copy_table(&boards[i], matrix);
+    }
+    bot_free(bot);
+    matrix_free(matrix);
+    return err_value;
+}
+
+/*
+ * Evaluate every board one at a time with bot_evaluate, then in batches with each kernel this
+ * CPU can run, and check that the batches give the same features.
+ */
+static int32_t bench_eval(const matrix_t* boards, uint32_t num_boards) {
+    static const char* kernel_names[NUM_BATCH_KERNELS] = { "scalar", "sse2", "avx2" };
+    bot_t* bot = bot_new(&boards[0]);
+    const matrix_t** board_ptrs = malloc(num_boards * sizeof(const matrix_t*));
+    features_t* expected = malloc(num_boards * sizeof(features_t));
+    features_t* features = malloc(num_boards * sizeof(features_t));
+    if (!bot || !board_ptrs || !expected || !features) {
+        bot_free(bot);
+        free(board_ptrs);
+        free(expected);
+        free(features);
+        return ERROR_BOT;
+    }
+    for (uint32_t i = 0; i < num_boards; ++i) {
+        board_ptrs[i] = &boards[i];
+    }
+    uint32_t evaluations = BENCH_ROUNDS * 100 * num_boards;
+    uint64_t start = SDL_GetPerformanceCounter();
+    for (uint32_t round = 0; round < BENCH_ROUNDS * 100; ++round) {
+        for (uint32_t i = 0; i < num_boards; ++i) {
+            bot_evaluate(&boards[i], &expected[i]);
+        }
+    }
+    printf("eval: per board %.1f ns", bench_seconds(start) * 1e9 / evaluations);
+    uint32_t default_kind = bot->batch.kernel_kind;
+    for (uint32_t kind = 0; kind < NUM_BATCH_KERNELS; ++kind) {
+        if (!batch_set_kernel(&bot->batch, kind)) {
+            continue;
+        }
+        start = SDL_GetPerformanceCounter();
+        for (uint32_t round = 0; round < BENCH_ROUNDS * 100; ++round) {
+            bot_eval_batch(bot, board_ptrs, num_boards, features);
+        }
+        double seconds = bench_seconds(start);
+        uint32_t mismatches = 0;
+        for (uint32_t i = 0; i < num_boards; ++i) {
+            const features_t* a = &expected[i];
+            const features_t* b = &features[i];
+            mismatches += a->holes != b->holes || a->line_dep_cells != b->line_dep_cells
+                          || a->in_rightmost_col != b->in_rightmost_col
+                          || a->stack_height != b->stack_height || a->spread != b->spread;
+        }
+        printf(", %s batch %.1f ns%s (%u mismatches)", kernel_names[kind],
+               seconds * 1e9 / evaluations, kind == default_kind ? " [used]" : "",
+               (unsigned)mismatches);
+    }
+    printf("\n");
+    bot_free(bot);
+    free(board_ptrs);
+    free(expected);
+    free(features);
+    return 0;
+}
+
+/*
+ * The evaluators bot_evaluate replaced, which look at every cell of the matrix. They are kept here
+ * as a reference for bench_ranking.
+ */
+static uint32_t bench_old_holes(const matrix_t* matrix) {
+    uint32_t holes = 0;
+    for (size_t c = 0; c < matrix->cols; ++c) {
+        bool top_reached = false;
+        for (size_t r = 0; r < matrix->rows; ++r) {
+            if (matrix->table[r][c] != TYPE_NONE) {
+                top_reached = true;
+            } else if (top_reached) {
+                ++holes;
+            }
+        }
+    }
+    return holes;
+}
+
+/* Count the cells that only a line piece can fill in one column, see bench_old_line_dep_cells. */
+static uint32_t bench_old_col_line_dep_cells(const matrix_t* matrix, size_t col) {
+    size_t r;
+    for (r = 0; r < matrix->rows; ++r) {
+        bool left = col == 0 || matrix->table[r][col - 1] != TYPE_NONE;
+        bool right = matrix->table[r][col + 1] != TYPE_NONE;
+        if (left && right) {
+            break;
+        }
+    }
+    uint32_t cells = 0;
+    for (r += 2; r < matrix->rows && matrix->table[r][col] == TYPE_NONE; ++r) {
+        ++cells;
+    }
+    return cells;
+}
+
+/* The rightmost column is ignored. */
+static uint32_t bench_old_line_dep_cells(const matrix_t* matrix) {
+    uint32_t cells = 0;
+    for (size_t c = 0; matrix->cols >= 2 && c < matrix->cols - 1; ++c) {
+        cells += bench_old_col_line_dep_cells(matrix, c);
+    }
+    return cells;
+}
+
+static double bench_old_deviation(const matrix_t* matrix) {
+    uint32_t cols = matrix->cols;
+    uint32_t heights[MATRIX_MAX_COLS];
+    uint32_t sum = 0;
+    for (size_t c = 0; c < cols; ++c) {
+        heights[c] = 0;
+        for (size_t r = 0; r < matrix->rows; ++r) {
+            if (matrix->table[r][c] != TYPE_NONE) {
+                heights[c] = matrix->rows - r;
+                break;
+            }
+        }
+        sum += heights[c];
+    }
+    double mean = (double)sum / cols;
+    double sum_squares = 0;
+    for (size_t c = 0; c < cols; ++c) {
+        sum_squares += pow(fabs(heights[c] - mean), 2);
+    }
+    return sqrt(sum_squares / (cols - 1));
+}
+
+static uint32_t bench_old_in_col(const matrix_t* matrix, size_t col) {
+    uint32_t num = 0;
+    for (size_t r = 0; r < matrix->rows; ++r) {
+        num += matrix->table[r][col] != TYPE_NONE;
+    }
+    return num;
+}
+
+/* A placement as ranked by the old evaluators. */
+typedef struct {
+    uint32_t holes;
+    uint32_t line_dep_cells;
+    uint32_t in_rightmost_col;
+    double deviation;
+} bench_old_features_t;
+
+/* The lexicographic ranking bot_find_place had with the old evaluators. */
+static bool bench_old_better(const bench_old_features_t* f, const bench_old_features_t* best) {
+    bool overwrite = f->holes < best->holes;
+    if (f->holes == best->holes) {
+        overwrite = f->line_dep_cells < best->line_dep_cells;
+        if (f->line_dep_cells == best->line_dep_cells) {
+            overwrite = f->in_rightmost_col < best->in_rightmost_col && f->holes == 0;
+            if (f->in_rightmost_col == best->in_rightmost_col || f->holes > 0) {
+                overwrite = f->deviation < best->deviation;
+                if (f->deviation == best->deviation) {
+                    overwrite = f->in_rightmost_col < best->in_rightmost_col;
+                }
+            }
+        }
+    }
+    return overwrite;
+}
+
+/*
+ * Return the features bot_evaluate gives placement `index` of the move generator on `matrix`.
+ */
+static void bench_placement_features(const movegen_t* gen, uint32_t index, piece_t* piece,
+                                     matrix_t* matrix, features_t* features) {
+    movegen_placement(gen, index, piece);
+    matrix_undo_t undo;
+    piece_place_clean(piece, matrix, &undo);
+    bot_evaluate(matrix, features);
+    matrix_undo(matrix, &undo);
+}
+
+/*
+ * Rank every placement of every piece type on every board with the old evaluators, and check that
+ * bot_find_place chooses the same one. The placements come from the move generator in both
+ * cases, so only the ranking is compared. Two kinds of difference are counted on their own, and
+ * any other difference fails the check:
+ * + Placements with the same holes, line dependencies, filled cells in the rightmost column and
+ *   spread are exact ties on all four features, which the old floating point deviation could
+ *   still tell apart by rounding.
+ * + With holes, the rightmost column only breaks ties in spread (see features_better in bot.c).
+ *   The old deviation could break such a tie by rounding before the rightmost column was looked
+ *   at, so the bot may choose a placement with the same holes, line dependencies and spread but
+ *   fewer filled cells in the rightmost column.
+ */
+static int32_t bench_ranking(const matrix_t* boards, uint32_t num_boards) {
+    bot_t* bot = bot_new(&boards[0]);
+    movegen_t* gen = malloc(sizeof(movegen_t));
+    matrix_t* matrix = matrix_new(boards[0].rows, boards[0].cols, boards[0].hidden_rows);
+    if (!bot || !gen || !matrix) {
+        bot_free(bot);
+        free(gen);
+        matrix_free(matrix);
+        return ERROR_BOT;
+    }
+    int32_t err_value = 0;
+    uint32_t chosen = 0;
+    uint32_t mismatches = 0;
+    uint32_t rounding_ties = 0;
+    uint32_t rightmost_ties = 0;
+    for (uint32_t i = 0; i < num_boards && err_value == 0; ++i) {
+        for (uint8_t type = TYPE_LINE; type <= NUM_PIECES && err_value == 0; ++type) {
+            err_value = bot_find_place(bot, &boards[i], type);
+            matrix_copy_table(matrix, &boards[i]);
+            piece_t piece;
+            piece_init(&piece, matrix, type);
+            uint32_t num_placements = movegen_run(gen, &piece, matrix);
+            if (err_value != 0 || num_placements == 0) {
+                continue;
+            }
+            bench_old_features_t best = { UINT32_MAX, UINT32_MAX, UINT32_MAX, INFINITY };
+            uint32_t best_index = 0;
+            for (uint32_t p = 0; p < num_placements; ++p) {
+                movegen_placement(gen, p, &piece);
+                matrix_undo_t undo;
+                piece_place_clean(&piece, matrix, &undo);
+                bench_old_features_t features = {
+                    bench_old_holes(matrix),
+                    bench_old_line_dep_cells(matrix),
+                    bench_old_in_col(matrix, matrix->cols - 1),
+                    bench_old_deviation(matrix),
+                };
+                matrix_undo(matrix, &undo);
+                if (bench_old_better(&features, &best)) {
+                    best = features;
+                    best_index = p;
+                }
+            }
+            ++chosen;
+            uint32_t bot_index = UINT32_MAX;
+            for (uint32_t p = 0; p < num_placements && bot_index == UINT32_MAX; ++p) {
+                movegen_placement(gen, p, &piece);
+                if (piece.orient_index == bot->dest_orient_index && piece.x == bot->dest_x
+                    && piece.y == bot->dest_y) {
+                    bot_index = p;
+                }
+            }
+            if (bot_index == best_index) {
+                continue;
+            }
+            features_t old_choice;
+            features_t bot_choice = { 0, 0, 0, 0, 0 };
+            bench_placement_features(gen, best_index, &piece, matrix, &old_choice);
+            if (bot_index != UINT32_MAX) {
+                bench_placement_features(gen, bot_index, &piece, matrix, &bot_choice);
+            }
+            bool spread_tie = bot_index != UINT32_MAX && old_choice.holes == bot_choice.holes
+                              && old_choice.line_dep_cells == bot_choice.line_dep_cells
+                              && old_choice.spread == bot_choice.spread;
+            if (spread_tie && old_choice.in_rightmost_col == bot_choice.in_rightmost_col) {
+                ++rounding_ties;
+            } else if (spread_tie && bot_choice.holes > 0
+                       && bot_choice.in_rightmost_col < old_choice.in_rightmost_col) {
+                ++rightmost_ties;
+            } else {
+                ++mismatches;
+            }
+        }
+    }
+    if (err_value == 0) {
+        printf("ranking: %u placements chosen, %u mismatches with the old evaluators, "
+               "%u exact ties broken by rounding, %u spread ties settled by the rightmost column\n",
+               (unsigned)chosen, (unsigned)mismatches, (unsigned)rounding_ties,
+               (unsigned)rightmost_ties);
+        if (mismatches > 0) {
+            err_value = ERROR_BENCH_CHECK;
+        }
+    }
+    bot_free(bot);
+    free(gen);
+    matrix_free(matrix);
+    return err_value;
+}
+
+/*
+ * Place random pieces on every board, clearing rows either with piece_place and matrix_clean as
+ * the game does or with piece_place_clean, and take some of them back with matrix_undo. Check
+ * after every change that the hash kept up to date by the matrix is the one its cells give.
+ */
+static int32_t bench_hash(const matrix_t* boards, uint32_t num_boards) {
+    matrix_t* matrix = matrix_new(boards[0].rows, boards[0].cols, boards[0].hidden_rows);
+    if (!matrix) {
+        return ERROR_MATRIX;
+    }
+    uint32_t changes = 0;
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < num_boards; ++i) {
+        matrix_copy_table(matrix, &boards[i]);
+        for (uint32_t j = 0; j < BENCH_ROUNDS; ++j) {
+            piece_t piece;
+            piece_init(&piece, matrix, rand() % NUM_PIECES + 1);
+            piece.orient_index = rand() % piece.orientations;
+            piece.x = rand() % matrix->cols - 1;
+            if (piece_collides(&piece, matrix)) {
+                matrix_clear(matrix);
+                continue;
+            }
+            piece_hard_drop(&piece, matrix);
+            matrix_undo_t undo;
+            uint32_t way = rand() % 3;
+            if (way == 0) {
+                piece_place(&piece, matrix);
+                matrix_clean(matrix, NULL);
+            } else {
+                piece_place_clean(&piece, matrix, &undo);
+            }
+            ++changes;
+            mismatches += matrix_hash(matrix) != matrix_hash_table(matrix);
+            if (way == 2) {
+                matrix_undo(matrix, &undo);
+                ++changes;
+                mismatches += matrix_hash(matrix) != matrix_hash_table(matrix);
+            }
+        }
+    }
+    printf("hash: %u changes, %u mismatches with the hash of the cells\n", (unsigned)changes,
+           (unsigned)mismatches);
+    matrix_free(matrix);
+    return mismatches > 0 ? ERROR_BENCH_CHECK : 0;
+}
+
+/* Time the move generator on every board with every piece type. */
+static int32_t bench_movegen(const matrix_t* boards, uint32_t num_boards) {
+    movegen_t* gen = malloc(sizeof(movegen_t));
+    if (!gen) {
+        return ERROR_BOT;
+    }
+    uint64_t states = 0;
+    uint64_t placements = 0;
+    uint64_t start = SDL_GetPerformanceCounter();
+    for (uint32_t round = 0; round < BENCH_ROUNDS; ++round) {
+        for (uint32_t i = 0; i < num_boards; ++i) {
+            for (uint8_t type = TYPE_LINE; type <= NUM_PIECES; ++type) {
+                piece_t piece;
+                piece_init(&piece, &boards[i], type);
+                placements += movegen_run(gen, &piece, &boards[i]);
+                states += gen->num_states;
+            }
+        }
+    }
+    double seconds = bench_seconds(start);
+    printf("movegen: %llu states, %llu placements in %.3f s (%.0f states/s, %.1f us per search)\n",
+           (unsigned long long)states, (unsigned long long)placements, seconds, states / seconds,
+           seconds * 1e6 / ((double)BENCH_ROUNDS * num_boards * NUM_PIECES));
+    free(gen);
+    return 0;
+}
+
+static void* bench_count_malloc(size_t size) {
+    SDL_AtomicAdd(&bench_num_mallocs, 1);
+    return bench_real_malloc(size);
+}
+
+static void* bench_count_calloc(size_t num, size_t size) {
+    SDL_AtomicAdd(&bench_num_mallocs, 1);
+    return bench_real_calloc(num, size);
+}
+
+static void* bench_count_realloc(void* mem, size_t size) {
+    SDL_AtomicAdd(&bench_num_reallocs, 1);
+    return bench_real_realloc(mem, size);
+}
+
+static void bench_count_free(void* mem) {
+    SDL_AtomicAdd(&bench_num_frees, 1);
+    bench_real_free(mem);
+}
+
+/*
+ * Let a bot with lookahead and a pool play a game while every call to SDL's allocator is counted,
+ * half of the pieces with bot_next_piece and bot_search and half with bot_step like main_loop.
+ * Once the bot is set up, choosing pieces and placements must not allocate memory, so any call
+ * fails the check. The bot's modules allocate with SDL_malloc for this reason.
+ */
+static int32_t bench_allocations(void) {
+    matrix_t* matrix = matrix_new(MATRIX_ROWS, MATRIX_COLS, MATRIX_HIDDEN_ROWS);
+    if (!matrix) {
+        return ERROR_MATRIX;
+    }
+    bot_t* bot = bot_new(matrix);
+    if (!bot || bot_set_threads(bot, BENCH_THREADS) != 0) {
+        bot_free(bot);
+        matrix_free(matrix);
+        return ERROR_BOT;
+    }
+    bot->search_depth = 3;
+    bot->search_budget_us = 2000;
+    SDL_AtomicSet(&bench_num_mallocs, 0);
+    SDL_AtomicSet(&bench_num_reallocs, 0);
+    SDL_AtomicSet(&bench_num_frees, 0);
+    SDL_GetMemoryFunctions(&bench_real_malloc, &bench_real_calloc, &bench_real_realloc,
+                           &bench_real_free);
+    SDL_SetMemoryFunctions(bench_count_malloc, bench_count_calloc, bench_count_realloc,
+                           bench_count_free);
+    int32_t err_value = 0;
+    piece_t piece;
+    for (uint32_t i = 0; i < BENCH_PIECES && err_value == 0; ++i) {
+        if (i % 2 == 0) {
+            err_value = bot_next_piece(bot, matrix, &piece);
+            if (err_value == 0) {
+                err_value = bot_search(bot, matrix, &piece);
+            }
+        } else {
+            /* a few frames of work, then the piece spawns whether the bot is done or not */
+            err_value = bot_start(bot, matrix);
+            for (uint32_t frame = 0; frame < 10 && err_value == 0 && !bot_done(bot); ++frame) {
+                err_value = bot_step(bot, 1000000);
+            }
+            if (err_value == 0) {
+                err_value = bot_spawn(bot, matrix, &piece);
+            }
+            if (err_value == 0) {
+                err_value = bot_search_finish(bot, matrix);
+            }
+        }
+        piece.orient_index = bot->dest_orient_index;
+        piece.x = bot->dest_x;
+        piece.y = bot->dest_y;
+        if (err_value != 0 || piece_collides(&piece, matrix)) {
+            matrix_clear(matrix);
+            continue;
+        }
+        piece_place(&piece, matrix);
+        matrix_clean(matrix, NULL);
+    }
+    SDL_SetMemoryFunctions(bench_real_malloc, bench_real_calloc, bench_real_realloc,
+                           bench_real_free);
+    bot_free(bot);
+    matrix_free(matrix);
+    uint32_t mallocs = SDL_AtomicGet(&bench_num_mallocs);
+    uint32_t reallocs = SDL_AtomicGet(&bench_num_reallocs);
+    uint32_t frees = SDL_AtomicGet(&bench_num_frees);
+    printf("allocations: %u malloc, %u realloc, %u free in %d pieces after bot_new\n",
+           (unsigned)mallocs, (unsigned)reallocs, (unsigned)frees, BENCH_PIECES);
+    if (err_value == 0 && mallocs + reallocs + frees > 0) {
+        err_value = ERROR_BENCH_CHECK;
+    }
+    return err_value;
+}
+
+/*
+ * Let the bot play the same game with different lookahead settings, and print the nodes searched
+ * per second, the depth reached and how well the stack was kept.
+ */
+static int32_t bench_search(void) {
+    matrix_t* matrix = matrix_new(MATRIX_ROWS, MATRIX_COLS, MATRIX_HIDDEN_ROWS);
+    if (!matrix) {
+        return ERROR_MATRIX;
+    }
+    bot_t* bot = bot_new(matrix);
+    if (!bot) {
+        matrix_free(matrix);
+        return ERROR_BOT;
+    }
+    int32_t err_value = 0;
+    size_t num_settings = sizeof(bench_search_settings) / sizeof(bench_search_settings[0]);
+    for (size_t s = 0; s < num_settings && err_value == 0; ++s) {
+        srand(BENCH_SEED);
+        bot->rng = rand();
+        bot->search_depth = bench_search_settings[s][0];
+        bot->beam_width = bench_search_settings[s][1];
+        bot->search_budget_us = bench_search_settings[s][2];
+        bot_clear_cache(bot);
+        matrix_clear(matrix);
+        uint64_t nodes = 0;
+        uint64_t depths = 0;
+        uint64_t micros = 0;
+        uint64_t heights = 0;
+        uint32_t max_us = 0;
+        uint32_t lines = 0;
+        uint32_t top_outs = 0;
+        piece_t piece;
+        for (uint32_t i = 0; i < BENCH_PIECES && err_value == 0; ++i) {
+            err_value = bot_next_piece(bot, matrix, &piece);
+            if (err_value == 0 && bot->search_depth > 1) {
+                err_value = bot_search(bot, matrix, &piece);
+            }
+            if (bot->search_depth > 1) {
+                nodes += bot->search_nodes;
+                depths += bot->search_depth_reached;
+                micros += bot->search_us;
+                max_us = bot->search_us > max_us ? bot->search_us : max_us;
+            } else {
+                depths += 1;
+            }
+            piece.orient_index = bot->dest_orient_index;
+            piece.x = bot->dest_x;
+            piece.y = bot->dest_y;
+            if (err_value != 0 || piece_collides(&piece, matrix)) {
+                matrix_clear(matrix);
+                ++top_outs;
+                continue;
+            }
+            piece_place(&piece, matrix);
+            lines += matrix_clean(matrix, NULL);
+            heights += matrix_stack_height(matrix);
+        }
+        printf("search depth %u beam %u budget %u us: %.0f nodes/s, depth %.2f, %.0f us mean, "
+               "%u us max, %u lines, %u top outs, height %.2f, %.1f%% cache hits\n",
+               (unsigned)bot->search_depth, (unsigned)bot->beam_width,
+               (unsigned)bot->search_budget_us, micros > 0 ? nodes * 1e6 / micros : 0.0,
+               (double)depths / BENCH_PIECES, (double)micros / BENCH_PIECES, (unsigned)max_us,
+               (unsigned)lines, (unsigned)top_outs, (double)heights / BENCH_PIECES,
+               bot->tt_probes > 0 ? bot->tt_hits * 100.0 / bot->tt_probes : 0.0);
+    }
+    bot_free(bot);
+    matrix_free(matrix);
+    return err_value;
+}
+
+/*
+ * Choose a piece and search ahead from it on every board, first on one thread and then with a
+ * pool of BENCH_THREADS threads, and check that both give the same pieces and placements.
+ */
+static int32_t bench_parallel(const matrix_t* boards, uint32_t num_boards) {
+    bot_t* bot = bot_new(&boards[0]);
+    int32_t* serial = malloc(num_boards * 4 * sizeof(int32_t));
+    if (!bot || !serial) {
+        bot_free(bot);
+        free(serial);
+        return ERROR_BOT;
+    }
+    bot->search_depth = 3;
+    bot->search_budget_us = UINT32_MAX;
+    int32_t err_value = 0;
+    double seconds[2] = { 0.0, 0.0 };
+    uint64_t evaluated[2] = { 0, 0 };
+    uint64_t skipped[2] = { 0, 0 };
+    uint32_t mismatches = 0;
+    for (uint32_t pass = 0; pass < 2 && err_value == 0; ++pass) {
+        if (pass == 1) {
+            err_value = bot_set_threads(bot, BENCH_THREADS);
+        }
+        /* both passes start without remembered placements, so neither gets the other's work */
+        bot_clear_cache(bot);
+        uint64_t start = SDL_GetPerformanceCounter();
+        for (uint32_t i = 0; i < num_boards && err_value == 0; ++i) {
+            piece_t piece;
+            bot->rng = i;
+            err_value = bot_next_piece(bot, &boards[i], &piece);
+            evaluated[pass] += bot->scratch.features_evaluated;
+            skipped[pass] += bot->scratch.features_skipped;
+            if (err_value == 0) {
+                err_value = bot_search(bot, &boards[i], &piece);
+            }
+            int32_t result[4] = { piece.type, bot->dest_orient_index, bot->dest_x, bot->dest_y };
+            if (pass == 0) {
+                memcpy(&serial[i * 4], result, sizeof(result));
+            } else if (memcmp(&serial[i * 4], result, sizeof(result)) != 0) {
+                ++mismatches;
+            }
+        }
+        seconds[pass] = bench_seconds(start);
+    }
+    if (err_value == 0) {
+        printf("parallel: %d threads on %d CPUs, %.1f us serial, %.1f us parallel per piece, "
+               "%u mismatches\n", BENCH_THREADS + 1, SDL_GetCPUCount(),
+               seconds[0] * 1e6 / num_boards, seconds[1] * 1e6 / num_boards,
+               (unsigned)mismatches);
+        for (uint32_t pass = 0; pass < 2; ++pass) {
+            uint64_t features = evaluated[pass] + skipped[pass];
+            printf("features %s: %.0f evaluated, %.0f skipped per piece (%.1f%% skipped)\n",
+                   pass == 0 ? "serial" : "parallel", (double)evaluated[pass] / num_boards,
+                   (double)skipped[pass] / num_boards,
+                   features > 0 ? 100.0 * skipped[pass] / features : 0.0);
+        }
+    }
+    free(serial);
+    bot_free(bot);
+    return err_value;
+}
+
+/*
+ * Compare the placements the surface table holds for `num_entries` signatures spread over the
+ * table with the ones the bot searches for, and add the entries that differ to `mismatches`.
+ * Return 0 on success or a non-zero value on failure.
+ */
+static int32_t bench_surface_entries(bot_t* bot, const surface_table_t* surface,
+                                     uint32_t num_entries, uint32_t* checked,
+                                     uint32_t* mismatches) {
+    const surface_header_t* header = &surface->header;
+    matrix_t* board = matrix_new(header->rows, header->cols, header->hidden_rows);
+    if (!board) {
+        return ERROR_MATRIX;
+    }
+    bot->surface = NULL;
+    int32_t err_value = 0;
+    for (uint32_t i = 0; i < num_entries && err_value == 0; ++i) {
+        uint32_t signature = (uint64_t)header->num_signatures * i / num_entries;
+        uint8_t heights[MATRIX_MAX_COLS];
+        if (!surface_heights(signature, board->rows, board->cols, header->max_delta, heights)) {
+            continue;
+        }
+        matrix_fill(board, heights, TYPE_O);
+        for (uint8_t type = 1; type <= NUM_PIECES && err_value == 0; ++type) {
+            piece_t piece;
+            if (!surface_lookup(surface, board, type, &piece)) {
+                continue;
+            }
+            err_value = bot_find_place(bot, board, type);
+            ++*checked;
+            if (piece.orient_index != bot->dest_orient_index || piece.x != bot->dest_x
+                || piece.y != bot->dest_y) {
+                ++*mismatches;
+            }
+        }
+    }
+    bot_clear_cache(bot);
+    matrix_free(board);
+    return err_value;
+}
+
+/*
+ * Find the placement of every piece type on every board, first by searching and then with the
+ * surface table next to the program, and check that the table gives the same placements. Only
+ * the boards without holes whose columns are close enough in height are in the table, so entries
+ * spread over the whole table are checked as well.
+ */
+static int32_t bench_surface(const matrix_t* boards, uint32_t num_boards) {
+    bot_t* bot = bot_new(&boards[0]);
+    int32_t* searched = malloc(num_boards * NUM_PIECES * 3 * sizeof(int32_t));
+    uint32_t fingerprint = 0;
+    int32_t err_value = bot && searched ? bot_fingerprint(bot, &fingerprint) : ERROR_BOT;
+    surface_table_t* surface = err_value == 0 ? surface_open_default(&boards[0], fingerprint)
+                                              : NULL;
+    if (err_value == 0 && !surface) {
+        printf("surface: no %s for this bot next to the program, see `make surface`\n",
+               SURFACE_FILE_NAME);
+    }
+    if (err_value != 0 || !surface) {
+        bot_free(bot);
+        free(searched);
+        return err_value;
+    }
+    double seconds[2] = { 0.0, 0.0 };
+    uint32_t mismatches = 0;
+    for (uint32_t pass = 0; pass < 2 && err_value == 0; ++pass) {
+        bot->surface = pass == 0 ? NULL : surface;
+        bot_clear_cache(bot);
+        uint64_t start = SDL_GetPerformanceCounter();
+        for (uint32_t i = 0; i < num_boards && err_value == 0; ++i) {
+            for (uint8_t type = 1; type <= NUM_PIECES && err_value == 0; ++type) {
+                err_value = bot_find_place(bot, &boards[i], type);
+                int32_t result[3] = { bot->dest_orient_index, bot->dest_x, bot->dest_y };
+                int32_t* slot = &searched[(i * NUM_PIECES + type - 1) * 3];
+                if (pass == 0) {
+                    memcpy(slot, result, sizeof(result));
+                } else if (memcmp(slot, result, sizeof(result)) != 0) {
+                    ++mismatches;
+                }
+            }
+        }
+        seconds[pass] = bench_seconds(start);
+    }
+    uint32_t checked = 0;
+    uint32_t entry_mismatches = 0;
+    if (err_value == 0) {
+        uint32_t lookups = num_boards * NUM_PIECES;
+        printf("surface: max delta %u, %.1f%% table hits, %.1f us searched, %.1f us with the "
+               "table per placement, %u mismatches\n",
+               (unsigned)surface->header.max_delta, bot->surface_hits * 100.0 / lookups,
+               seconds[0] * 1e6 / lookups, seconds[1] * 1e6 / lookups, (unsigned)mismatches);
+        err_value = bench_surface_entries(bot, surface, BENCH_SURFACE_ENTRIES, &checked,
+                                          &entry_mismatches);
+    }
+    if (err_value == 0) {
+        printf("surface entries: %u checked, %u mismatches\n", (unsigned)checked,
+               (unsigned)entry_mismatches);
+        if (mismatches > 0 || entry_mismatches > 0) {
+            err_value = ERROR_BENCH_CHECK;
+        }
+    }
+    free(searched);
+    bot_free(bot);
+    surface_close(surface);
+    return err_value;
+}
+
+#if BENCH_FILL
+enum {
+    BENCH_FILL_PIXELS = 1 << 24, /* pixels filled per run of a method and size by bench_fill */
+    BENCH_FILL_REPEATS = 5,
+};
+
+/* texture sizes in pixels compared by bench_fill: the default board, screens, walls of screens */
+static const uint32_t bench_fill_sizes[][2] = {
+    { 80, 160 },
+    { 640, 480 },
+    { 1920, 1080 },
+    { 3840, 2160 },
+    { 7680, 2160 },
+};
+
+/* Fill pixels a byte at a time, the way graphics_clear did before the cells were tiles. */
+static void bench_fill_bytes(fill_kernel_t kernel, uint8_t* pixels, uint32_t width,
+                             uint32_t height, uint32_t pixel) {
+    (void)kernel;
+    uint8_t bytes[sizeof(pixel)];
+    memcpy(bytes, &pixel, sizeof(pixel));
+    for (size_t i = 0; i < (size_t)width * height; ++i) {
+        pixels[i * sizeof(pixel)] = bytes[0];
+        pixels[i * sizeof(pixel) + 1] = bytes[1];
+        pixels[i * sizeof(pixel) + 2] = bytes[2];
+        pixels[i * sizeof(pixel) + 3] = bytes[3];
+    }
+}
+
+/* Fill pixels by copying an 8x8 tile to every cell, the way graphics.c draws the backgrounds. */
+static void bench_fill_tiles(fill_kernel_t kernel, uint8_t* pixels, uint32_t width,
+                             uint32_t height, uint32_t pixel) {
+    (void)kernel;
+    uint32_t tile[8][8];
+    for (size_t y = 0; y < 8; ++y) {
+        for (size_t x = 0; x < 8; ++x) {
+            tile[y][x] = pixel;
+        }
+    }
+    size_t pitch = (size_t)width * sizeof(pixel);
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; x += 8) {
+            memcpy(pixels + y * pitch + x * sizeof(pixel), tile[y % 8], sizeof(tile[y % 8]));
+        }
+    }
+}
+
+static void bench_fill_kernel(fill_kernel_t kernel, uint8_t* pixels, uint32_t width,
+                              uint32_t height, uint32_t pixel) {
+    fill_rect(kernel, pixels, (int32_t)(width * sizeof(pixel)), width, height, pixel);
+}
+
+typedef void (*bench_fill_t)(fill_kernel_t kernel, uint8_t* pixels, uint32_t width,
+                             uint32_t height, uint32_t pixel);
+
+/*
+ * Return the time in microseconds of one fill of `width` by `height` pixels, the best of
+ * BENCH_FILL_REPEATS runs of `rounds` fills so that a slow run does not decide, and add the
+ * pixels that did not come out as `pixel` to `mismatches`.
+ */
+static double bench_fill_time(bench_fill_t fill, fill_kernel_t kernel, uint8_t* pixels,
+                              uint32_t width, uint32_t height, uint32_t rounds,
+                              uint32_t* mismatches) {
+    const uint32_t pixel = 0x000000BF; /* the gray background */
+    size_t count = (size_t)width * height;
+    double best = 0.0;
+    for (uint32_t repeat = 0; repeat < BENCH_FILL_REPEATS; ++repeat) {
+        memset(pixels, 0, count * sizeof(pixel));
+        uint64_t start = SDL_GetPerformanceCounter();
+        for (uint32_t round = 0; round < rounds; ++round) {
+            fill(kernel, pixels, width, height, pixel);
+        }
+        double seconds = bench_seconds(start);
+        best = repeat == 0 || seconds < best ? seconds : best;
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t value;
+            memcpy(&value, pixels + i * sizeof(value), sizeof(value));
+            *mismatches += value != pixel;
+        }
+    }
+    return best * 1e6 / rounds;
+}
+
+/*
+ * Time the fill kernels against the loops that clear the background of the texture, from the
+ * default texture size up to walls of screens, which are bigger than the cache.
+ */
+static int32_t bench_fill(void) {
+    static const char* kernel_names[NUM_FILL_KERNELS] = { "scalar", "sse2", "avx2" };
+    uint32_t default_kind = fill_best_kind();
+    for (size_t s = 0; s < sizeof(bench_fill_sizes) / sizeof(bench_fill_sizes[0]); ++s) {
+        uint32_t width = bench_fill_sizes[s][0];
+        uint32_t height = bench_fill_sizes[s][1];
+        size_t count = (size_t)width * height;
+        uint32_t rounds = count < BENCH_FILL_PIXELS ? BENCH_FILL_PIXELS / count : 1;
+        uint8_t* pixels = malloc(count * sizeof(uint32_t));
+        if (!pixels) {
+            return ERROR_GRAPHICS;
+        }
+        uint32_t mismatches = 0;
+        printf("fill %ux%u: bytes %.1f us, tiles %.1f us", (unsigned)width, (unsigned)height,
+               bench_fill_time(bench_fill_bytes, NULL, pixels, width, height, rounds,
+                               &mismatches),
+               bench_fill_time(bench_fill_tiles, NULL, pixels, width, height, rounds,
+                               &mismatches));
+        for (uint32_t kind = 0; kind < NUM_FILL_KERNELS; ++kind) {
+            fill_kernel_t kernel = fill_get_kernel(kind);
+            if (kernel) {
+                printf(", %s %.1f us%s", kernel_names[kind],
+                       bench_fill_time(bench_fill_kernel, kernel, pixels, width, height, rounds,
+                                       &mismatches),
+                       kind == default_kind ? " [best]" : "");
+            }
+        }
+        printf(" (%u mismatches)\n", (unsigned)mismatches);
+        free(pixels);
+    }
+    return 0;
+}
+#endif /* BENCH_FILL */
+
+/*
+ * Run the benchmarks and print the results. The boards are the same on every run. Return 0 on
+ * success or a non-zero value on failure.
+ */
+int32_t bench_run(void) {
+    matrix_t* boards = malloc(BENCH_BOARDS * sizeof(matrix_t));
+    if (!boards) {
+        return ERROR_MATRIX;
+    }
+    srand(BENCH_SEED);
+    int32_t err_value = bench_boards(boards, BENCH_BOARDS);
+    if (err_value == 0) {
+        err_value = bench_allocations();
+    }
+    if (err_value == 0) {
+        err_value = bench_ranking(boards, BENCH_BOARDS);
+    }
+    if (err_value == 0) {
+        err_value = bench_hash(boards, BENCH_BOARDS);
+    }
+    if (err_value == 0) {
+        err_value = bench_movegen(boards, BENCH_BOARDS);
+    }
+    if (err_value == 0) {
+        err_value = bench_eval(boards, BENCH_BOARDS);
+    }
+    if (err_value == 0) {
+        err_value = bench_search();
+    }
+    if (err_value == 0) {
+        err_value = bench_parallel(boards, BENCH_BOARDS);
+    }
+    if (err_value == 0) {
+        err_value = bench_surface(boards, BENCH_BOARDS);
+    }
+#if BENCH_FILL
+    if (err_value == 0) {
+        err_value = bench_fill();
+    }
+#endif
+    free(boards);
+    return err_value;
+}
@@ -23,12 +23,21 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
-#include <math.h>
-#include <float.h>
+#include "SDL_stdinc.h"
+#include "SDL_timer.h"
 #include "bot.h"
 #include "errorvalues.h"
 
+/* index of a placement taken from the surface table, see bot_surface_probe */
+#define BOT_INDEX_SURFACE (UINT32_MAX - 1)
+
+/* holes, line dependencies, rightmost column, then stack height and spread */
+enum {
+    FEATURE_STAGES = 4,
+};
+
 void inputs_clear(inputs_t* inputs) {
     inputs->left = false;
     inputs->right = false;
@@ -37,159 +46,438 @@ void inputs_clear(inputs_t* inputs) {
     inputs->cw = false;
 }
 
-bot_t bot_new(void) {
-    return (bot_t) {
-        .holes = 0,
-        .line_deps_cells = 0,
-        .dest_orient_index = 0,
-        .dest_x = 0,
-    };
-}
-
-/* Count empty cells that are under at least one filled cell. */
-uint32_t count_holes(const matrix_t* matrix) {
-    uint32_t holes = 0;
-    bool top_reached;
-    for (size_t c = 0; c < matrix->cols; ++c) {
-        top_reached = false;
-        for (size_t r = 0; r < matrix->rows; ++r) {
-            if (!top_reached) {
-                if (matrix->table[r][c] != TYPE_NONE) {
-                    top_reached = true;
-                }
-            } else {
-                if (matrix->table[r][c] == TYPE_NONE) {
-                    ++holes;
-                }
-            }
-        }
+/*
+ * Create a new bot for matrices with the same dimensions as `matrix`. Everything the bot needs to
+ * search for placements is allocated here, so choosing pieces and placements will not allocate
+ * memory. Return NULL on failure.
+ */
+bot_t* bot_new(const matrix_t* matrix) {
+    bot_t* bot = SDL_malloc(sizeof(bot_t));
+    if (!bot) {
+        return NULL;
+    }
+    if (!matrix_init(&bot->scratch.matrix, matrix->rows, matrix->cols, matrix->hidden_rows)) {
+        SDL_free(bot);
+        return NULL;
     }
-    return holes;
+    matrix_init(&bot->board, matrix->rows, matrix->cols, matrix->hidden_rows);
+    for (size_t i = 0; i < BOT_MAX_BEAM; ++i) {
+        matrix_init(&bot->beam[0][i].board, matrix->rows, matrix->cols, matrix->hidden_rows);
+        matrix_init(&bot->beam[1][i].board, matrix->rows, matrix->cols, matrix->hidden_rows);
+    }
+    bot->holes = 0;
+    bot->line_deps_cells = 0;
+    bot->stack_height = 0;
+    bot->dest_orient_index = 0;
+    bot->dest_x = 0;
+    bot->dest_y = 0;
+    bot->path_len = 0;
+    bot->path_states[0] = UINT16_MAX;
+    bot->scratch.generated = false;
+    bot->scratch.features_evaluated = 0;
+    bot->scratch.features_skipped = 0;
+    bot->rng = rand();
+    bot->search_depth = 1;
+    bot->beam_width = BOT_DEFAULT_BEAM;
+    bot->search_budget_us = 0;
+    bot->search_nodes = 0;
+    bot->search_depth_reached = 0;
+    bot->search_us = 0;
+    bot->search_ticks = 0;
+    bot->expand_ticks_max = 0;
+    bot->searching = false;
+    bot->search_complete = false;
+    bot->search_pending = false;
+    bot->choosing = false;
+    bot->bag_type = TYPE_NONE;
+    bot->bag_index = 0;
+    bot->pool = NULL;
+    bot->workers = NULL;
+    bot->num_workers = 0;
+    bot->choose_job.running = false;
+    bot->surface = NULL;
+    batch_init(&bot->batch, matrix);
+    bot_clear_cache(bot);
+    return bot;
 }
 
 /*
- * Count empty cells that can only be filled with a line piece. Any gap that is exactly one cell
- * wide and at least three cells deep will have at least one of these cells.
+ * Count empty cells in a column that can only be filled with a line piece. Any gap that is
+ * exactly one cell wide and at least three cells deep will have at least one of these cells. The
+ * matrix needs to be at least two columns wide.
  *
- * This function needs a matrix at least two columns wide. This function will return 0 if the
- * matrix is less than two columns wide.
+ * This works on the column words of the matrix: the first row from the top where both neighbours
+ * are filled is the lowest bit of their AND (a missing neighbour at the edge counts as filled).
+ * The cells start two rows under it and end at the first block of the column under that, or at
+ * the bottom.
  */
-uint32_t count_line_dep_cells(const matrix_t* matrix, bool ignore_rightmost_col) {
-    if (matrix->cols < 2) {
+static uint32_t count_col_line_dep_cells(const matrix_t* matrix, uint32_t col) {
+    uint32_t left = col > 0 ? matrix->col_bits[col - 1] : UINT32_MAX;
+    uint32_t right = col + 1 < matrix->cols ? matrix->col_bits[col + 1] : UINT32_MAX;
+    uint32_t both = left & right;
+    if (both == 0) {
         return 0;
     }
+    uint32_t top = both & (0u - both);
+    uint32_t below = matrix->col_bits[col] & ~((top << 2) - 1);
+    uint32_t start = MATRIX_LOWEST_BIT(top) + 2;
+    uint32_t end = below != 0 ? MATRIX_LOWEST_BIT(below) : matrix->rows;
+    return end > start ? end - start : 0;
+}
+
+/* Count the empty cells that are under at least one filled cell, see bot_evaluate. */
+static uint32_t count_holes(const matrix_t* matrix) {
+    uint32_t under_tops = 0;
+    for (size_t c = 0; c < matrix->cols; ++c) {
+        under_tops += matrix_col_height(matrix, c);
+    }
+    return under_tops - matrix_cell_count(matrix);
+}
+
+/* Count the empty cells that only a line piece can fill, see bot_evaluate. */
+static uint32_t count_line_dep_cells(const matrix_t* matrix) {
     uint32_t cells = 0;
-    size_t r;
-    /* left-most column */
-    for (r = 0; r < matrix->rows; ++r) {
-        if (matrix->table[r][1] != TYPE_NONE) {
-            break;
-        }
+    for (size_t c = 0; matrix->cols >= 2 && c < matrix->cols - 1; ++c) {
+        cells += count_col_line_dep_cells(matrix, c);
     }
-    r += 2;
-    for ( ; r < matrix->rows; ++r) {
-        if (matrix->table[r][0] == TYPE_NONE) {
-            ++cells;
-        } else {
-            break;
+    return cells;
+}
+
+/* Set `stack_height` and `spread` of `features` from the column heights, see bot_evaluate. */
+static void count_heights(const matrix_t* matrix, features_t* features) {
+    uint32_t cols = matrix->cols;
+    uint32_t stack_height = 0;
+    int64_t sum = 0;
+    int64_t sum_squares = 0;
+    for (size_t c = 0; c < cols; ++c) {
+        uint32_t height = matrix_col_height(matrix, c);
+        sum += height;
+        sum_squares += (int64_t)height * height;
+        if (height > stack_height) {
+            stack_height = height;
         }
     }
-    /* between left and right-most column */
-    for (size_t c = 1; c < matrix->cols - 1; ++c) {
-        for (r = 0; r < matrix->rows; ++r) {
-            if (matrix->table[r][c - 1] != TYPE_NONE && matrix->table[r][c + 1] != TYPE_NONE) {
-                break;
-            }
+    features->stack_height = stack_height;
+    features->spread = cols * sum_squares - sum * sum;
+}
+
+/*
+ * Evaluate a matrix:
+ * + `holes` counts empty cells that are under at least one filled cell. Every filled cell is at
+ *   or below the top of its column, so these are the cells under the tops that are not filled.
+ * + `line_dep_cells` counts empty cells that can only be filled with a line piece. The rightmost
+ *   column is ignored, since it is kept empty on purpose. This needs a matrix at least two
+ *   columns wide, and is 0 otherwise.
+ * + `in_rightmost_col` counts filled cells in the rightmost column.
+ * + `stack_height` is the height of the highest column.
+ * + `spread` is `n * sum(h^2) - sum(h)^2` for the `n` column heights `h`. It is `n * (n - 1)`
+ *   times the variance of the heights, so it orders matrices the same way as the standard
+ *   deviation of the heights without any floating point math.
+ */
+void bot_evaluate(const matrix_t* matrix, features_t* features) {
+    uint32_t cols = matrix->cols;
+    features->holes = count_holes(matrix);
+    features->line_dep_cells = count_line_dep_cells(matrix);
+    features->in_rightmost_col = cols > 0 ? matrix_col_count(matrix, cols - 1) : 0;
+    count_heights(matrix, features);
+}
+
+static void bot_batch_features(const batch_t* batch, uint32_t lane, features_t* features) {
+    features->holes = batch->holes[lane];
+    features->line_dep_cells = batch->line_dep_cells[lane];
+    features->in_rightmost_col = batch->in_rightmost_col[lane];
+    features->stack_height = batch->stack_height[lane];
+    features->spread = batch->spread[lane];
+}
+
+/*
+ * Evaluate `num_boards` matrices like bot_evaluate, BATCH_MAX at a time with the widest SIMD
+ * kernel the CPU has (see batch.h). The matrices must have the dimensions of the bot's matrices.
+ */
+void bot_eval_batch(bot_t* bot, const matrix_t* const* boards, uint32_t num_boards,
+                    features_t* features) {
+    batch_t* batch = &bot->batch;
+    for (uint32_t first = 0; first < num_boards; first += BATCH_MAX) {
+        uint32_t last = first + BATCH_MAX < num_boards ? first + BATCH_MAX : num_boards;
+        for (uint32_t i = first; i < last; ++i) {
+            batch_add(batch, boards[i]);
         }
-        r += 2;
-        for ( ; r < matrix->rows; ++r) {
-            if (matrix->table[r][c] == TYPE_NONE) {
-                ++cells;
-            } else {
-                break;
-            }
+        batch_run(batch);
+        for (uint32_t i = first; i < last; ++i) {
+            bot_batch_features(batch, i - first, &features[i]);
         }
     }
-    /* right-most column */
-    if (!ignore_rightmost_col) {
-        for (r = 0; r < matrix->rows; ++r) {
-            if (matrix->table[r][matrix->cols - 2] != TYPE_NONE) {
-                break;
-            }
-        }
-        r += 2;
-        for ( ; r < matrix->rows; ++r) {
-            if (matrix->table[r][matrix->cols - 1] == TYPE_NONE) {
-                ++cells;
-            } else {
-                break;
+}
+
+/*
+ * Return whether a placement is better than the best placement found so far. Placements with the
+ * same spread are exact ties: the old floating point deviation broke some of them by rounding, in
+ * a way that depended on the order of the columns. They now go on to the rightmost column, and if
+ * that ties too the placement found first is kept. bench_ranking checks that this is the only way
+ * the ranking differs from the old evaluators.
+ */
+static bool features_better(const features_t* features, const features_t* best) {
+    bool overwrite = features->holes < best->holes;
+    if (features->holes == best->holes) {
+        overwrite = features->line_dep_cells < best->line_dep_cells;
+        if (features->line_dep_cells == best->line_dep_cells) {
+            overwrite = features->in_rightmost_col < best->in_rightmost_col && features->holes == 0;
+            if (features->in_rightmost_col == best->in_rightmost_col || features->holes > 0) {
+                overwrite = features->spread < best->spread;
+                if (features->spread == best->spread) {
+                    overwrite = features->in_rightmost_col < best->in_rightmost_col;
+                }
             }
         }
     }
-    return cells;
+    return overwrite;
 }
 
-/* Find the standard deviation of the heights of each column of the stack. */
-double stack_deviation(const matrix_t* matrix) {
+/*
+ * Return whether a placement is better than the best placement found so far. The features are
+ * evaluated in order of priority, and evaluation stops as soon as the placement is known to be
+ * worse than `best`. `features` is only complete when this function returns true. The number of
+ * features that did not need to be evaluated is added to the statistics of `scratch`.
+ */
+static bool bot_evaluate_better(bot_scratch_t* scratch, const matrix_t* matrix,
+                                const features_t* best, features_t* features) {
     uint32_t cols = matrix->cols;
-    uint32_t heights[cols];
-    for (size_t c = 0; c < cols; ++c) {
-        heights[c] = 0;
-        for (size_t r = 0; r < matrix->rows; ++r) {
-            if (matrix->table[r][c] != TYPE_NONE) {
-                heights[c] = matrix->rows - r;
-                break;
-            }
+    features->holes = count_holes(matrix);
+    ++scratch->features_evaluated;
+    if (features->holes > best->holes) {
+        scratch->features_skipped += FEATURE_STAGES - 1;
+        return false;
+    }
+
+    features->line_dep_cells = count_line_dep_cells(matrix);
+    ++scratch->features_evaluated;
+    if (features->holes == best->holes && features->line_dep_cells > best->line_dep_cells) {
+        scratch->features_skipped += FEATURE_STAGES - 2;
+        return false;
+    }
+
+    features->in_rightmost_col = cols > 0 ? matrix_col_count(matrix, cols - 1) : 0;
+    ++scratch->features_evaluated;
+    if (features->holes == best->holes && features->line_dep_cells == best->line_dep_cells
+        && features->holes == 0 && features->in_rightmost_col > best->in_rightmost_col) {
+        scratch->features_skipped += FEATURE_STAGES - 3;
+        return false;
+    }
+
+    count_heights(matrix, features);
+    ++scratch->features_evaluated;
+    return features_better(features, best);
+}
+
+/* Advance the bot's random state and return the next random number, see bot_next_piece. */
+static uint32_t bot_rand(uint32_t* state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 16;
+}
+
+/*
+ * Find the best placement of a piece of type `piece_type` on `matrix` and store its features in
+ * `best`. The placements are left in the move generator of `scratch`, and `best_index` is set to
+ * the index of the best one, or UINT32_MAX if the piece can not be placed at all. Return 0 on
+ * success or a non-zero value on failure.
+ */
+static int32_t bot_search_type(bot_scratch_t* scratch, const matrix_t* matrix, uint8_t piece_type,
+                               features_t* best, uint32_t* best_index) {
+    matrix_t* tmp_matrix = &scratch->matrix;
+    piece_t* tmp_piece = &scratch->piece;
+    if (!piece_init(tmp_piece, tmp_matrix, piece_type)) {
+        return ERROR_PIECE;
+    }
+    if (!matrix_copy_table(tmp_matrix, matrix)) {
+        return ERROR_MATRIX_DIM_MISMATCH;
+    }
+    best->holes = UINT32_MAX;
+    best->line_dep_cells = UINT32_MAX;
+    best->in_rightmost_col = UINT32_MAX;
+    best->stack_height = UINT32_MAX;
+    best->spread = INT64_MAX;
+    *best_index = UINT32_MAX;
+    uint32_t num_placements = movegen_run(&scratch->movegen, tmp_piece, tmp_matrix);
+    scratch->generated = true;
+    for (uint32_t i = 0; i < num_placements; ++i) {
+        movegen_placement(&scratch->movegen, i, tmp_piece);
+        matrix_undo_t undo;
+        piece_place_clean(tmp_piece, tmp_matrix, &undo);
+        /* evaluate the placement */
+        features_t features;
+        bool better = bot_evaluate_better(scratch, tmp_matrix, best, &features);
+        matrix_undo(tmp_matrix, &undo);
+        if (better) {
+            *best = features;
+            *best_index = i;
         }
     }
-    uint32_t sum = 0;
-    for (size_t i = 0; i < cols; ++i) {
-        sum += heights[i];
+    return 0;
+}
+
+/*
+ * Return the key of the transposition table entry for a piece type on a board. The type is mixed
+ * into the hash of the board so that the types of one board do not land next to each other.
+ */
+static uint64_t bot_tt_key(const matrix_t* matrix, uint8_t piece_type) {
+    return matrix_hash(matrix) ^ (piece_type * 0x9E3779B97F4A7C15u);
+}
+
+static bot_tt_entry_t* bot_tt_entry(bot_t* bot, uint64_t key) {
+    return &bot->tt[key >> (64 - BOT_TT_BITS)];
+}
+
+/*
+ * Look for the best placement of a piece type on `matrix` in the transposition table. Return
+ * whether it was found, in which case `best` and `best_index` are set like bot_search_type does.
+ */
+static bool bot_tt_probe(bot_t* bot, const matrix_t* matrix, uint8_t piece_type,
+                         features_t* best, uint32_t* best_index) {
+    uint64_t key = bot_tt_key(matrix, piece_type);
+    const bot_tt_entry_t* entry = bot_tt_entry(bot, key);
+    ++bot->tt_probes;
+    if (!entry->used || entry->key != key) {
+        return false;
     }
-    double mean = (double)sum / cols;
-    double sum_squares = 0;
-    for (size_t i = 0; i < cols; ++i) {
-        sum_squares += pow(fabs(heights[i] - mean), 2);
+    ++bot->tt_hits;
+    if (entry->best_index == UINT16_MAX) {
+        best->holes = UINT32_MAX;
+        best->line_dep_cells = UINT32_MAX;
+        best->in_rightmost_col = UINT32_MAX;
+        best->stack_height = UINT32_MAX;
+        best->spread = INT64_MAX;
+        *best_index = UINT32_MAX;
+        return true;
     }
-    return sqrt(sum_squares / (cols - 1));
+    best->holes = entry->holes;
+    best->line_dep_cells = entry->line_dep_cells;
+    best->in_rightmost_col = entry->in_rightmost_col;
+    best->stack_height = entry->stack_height;
+    best->spread = entry->spread;
+    *best_index = entry->best_index;
+    return true;
 }
 
-uint32_t get_stack_height(const matrix_t* matrix) {
-    for (size_t r = 0; r < matrix->rows; ++r) {
-        for (size_t c = 0; c < matrix->cols; ++c) {
-            if (matrix->table[r][c] != TYPE_NONE) {
-                return (matrix->rows - r);
-            }
+/* Remember the best placement of a piece type on `matrix`, replacing whatever was there. */
+static void bot_tt_store(bot_t* bot, const matrix_t* matrix, uint8_t piece_type,
+                         const features_t* best, uint32_t best_index) {
+    uint64_t key = bot_tt_key(matrix, piece_type);
+    bot_tt_entry_t* entry = bot_tt_entry(bot, key);
+    entry->key = key;
+    entry->used = true;
+    entry->best_index = best_index == UINT32_MAX ? UINT16_MAX : best_index;
+    entry->holes = best->holes;
+    entry->line_dep_cells = best->line_dep_cells;
+    entry->in_rightmost_col = best->in_rightmost_col;
+    entry->stack_height = best->stack_height;
+    entry->spread = best->spread;
+}
+
+/*
+ * Look for the placement of a piece type on `matrix` in the bot's surface table, and evaluate it
+ * on the scratch board. The table holds the placement bot_search_type would find, so only one
+ * placement is tried instead of all of them. Return whether it was found, in which case `best`
+ * holds its features and `best_index` is BOT_INDEX_SURFACE.
+ */
+static bool bot_surface_probe(bot_t* bot, const matrix_t* matrix, uint8_t piece_type,
+                              features_t* best, uint32_t* best_index) {
+    piece_t* piece = &bot->scratch.surface_piece;
+    matrix_t* tmp_matrix = &bot->scratch.matrix;
+    if (!surface_lookup(bot->surface, matrix, piece_type, piece)
+        || !matrix_copy_table(tmp_matrix, matrix)) {
+        return false;
+    }
+    matrix_undo_t undo;
+    piece_place_clean(piece, tmp_matrix, &undo);
+    bot_evaluate(tmp_matrix, best);
+    matrix_undo(tmp_matrix, &undo);
+    *best_index = BOT_INDEX_SURFACE;
+    ++bot->surface_hits;
+    return true;
+}
+
+/*
+ * Like bot_search_type on the bot's own scratch board, but look in the transposition table first
+ * and then in the surface table, and remember the result in the transposition table on a miss.
+ * A hit skips generating and trying the placements, so the bot's move generator is then left
+ * empty until bot_generate is called. Boards come back often: the boards bot_search kept are the
+ * ones the next pieces are chosen for, and bot_start, bot_search_begin and bot_search_finish all
+ * look at the same board. The table is lossy, so an entry is simply overwritten by a newer one
+ * with the same slot. Return 0 on success or a non-zero value on failure.
+ */
+static int32_t bot_search_cached(bot_t* bot, const matrix_t* matrix, uint8_t piece_type,
+                                 features_t* best, uint32_t* best_index) {
+    if (!bot_tt_probe(bot, matrix, piece_type, best, best_index)
+        && !bot_surface_probe(bot, matrix, piece_type, best, best_index)) {
+        int32_t tmp_err_value = bot_search_type(&bot->scratch, matrix, piece_type, best,
+                                                best_index);
+        if (tmp_err_value == 0) {
+            bot_tt_store(bot, matrix, piece_type, best, *best_index);
         }
+        return tmp_err_value;
+    }
+    if (!piece_init(&bot->scratch.piece, &bot->scratch.matrix, piece_type)) {
+        return ERROR_PIECE;
+    }
+    if (!matrix_copy_table(&bot->scratch.matrix, matrix)) {
+        return ERROR_MATRIX_DIM_MISMATCH;
     }
+    bot->scratch.generated = false;
     return 0;
 }
 
-/* Count filled cells in a column. */
-uint32_t count_in_col(const matrix_t* matrix, uint32_t col) {
-    uint32_t num = 0;
-    for (size_t r = 0; r < matrix->rows; ++r) {
-        if (matrix->table[r][col] != TYPE_NONE) {
-            ++num;
-        };
+/* Generate the placements of the scratch piece if bot_search_cached skipped them. */
+static void bot_generate(bot_scratch_t* scratch) {
+    if (!scratch->generated) {
+        movegen_run(&scratch->movegen, &scratch->piece, &scratch->matrix);
+        scratch->generated = true;
     }
-    return num;
 }
 
 /*
- * Return a piece that satisfies certain conditions:
- * + The piece can be placed without making more holes in the stack.
- * + The piece can be placed without creating more line dependencies.
- * + The piece can be placed without making the stack too high.
- *
- * If there is no piece that satisfies these conditions, then return a random piece. This function
- * may test the tetriminoes in random order. Because this function calls rand(), srand() should be
- * called at least once before calling this function.
- *
- * See documentation on bot_find_place.
+ * Make placement `index` of the bot's move generator the destination, the placement found in the
+ * surface table if `index` is BOT_INDEX_SURFACE, or the spawn position of the scratch piece if
+ * `index` is UINT32_MAX.
  */
-piece_t* bot_next_piece(bot_t* bot, const matrix_t* matrix, int32_t* err_value) {
-    uint8_t bag[NUM_PIECES] = {
+static void bot_set_dest(bot_t* bot, uint32_t index, const features_t* features) {
+    piece_t* tmp_piece = &bot->scratch.piece;
+    bot->holes = features->holes;
+    bot->line_deps_cells = features->line_dep_cells;
+    bot->stack_height = features->stack_height;
+    if (index == BOT_INDEX_SURFACE) {
+        /*
+         * There is no path, so bot_update_inputs rotates, moves and drops the piece, which
+         * tools/surfacegen.c checked to end up in the placement.
+         */
+        bot->dest_orient_index = bot->scratch.surface_piece.orient_index;
+        bot->dest_x = bot->scratch.surface_piece.x;
+        bot->dest_y = bot->scratch.surface_piece.y;
+        bot->path_len = 0;
+        bot->path_states[0] = UINT16_MAX;
+        return;
+    }
+    if (index == UINT32_MAX) {
+        bot->dest_orient_index = tmp_piece->orient_index;
+        bot->dest_x = tmp_piece->x;
+        bot->dest_y = tmp_piece->y;
+        bot->path_len = 0;
+        bot->path_states[0] = UINT16_MAX; /* not a state, so the path is never followed */
+        return;
+    }
+    bot_generate(&bot->scratch);
+    movegen_placement(&bot->scratch.movegen, index, tmp_piece);
+    bot->dest_orient_index = tmp_piece->orient_index;
+    bot->dest_x = tmp_piece->x;
+    bot->dest_y = tmp_piece->y;
+    bot->path_len = movegen_path(&bot->scratch.movegen, index, bot->path, bot->path_states);
+}
+
+/*
+ * Shuffle the bag of piece types into `bag` with random numbers from `rng`, and return a random
+ * type to give if none of them satisfies the conditions in bot_next_piece.
+ */
+static uint8_t bot_draw_bag(uint32_t* rng, uint8_t* bag) {
+    uint8_t types[NUM_PIECES] = {
         TYPE_LINE,
         TYPE_O,
         TYPE_J,
@@ -198,43 +486,300 @@ piece_t* bot_next_piece(bot_t* bot, const matrix_t* matrix, int32_t* err_value)
         TYPE_T,
         TYPE_Z,
     };
-    /* Shuffle the bag. */
-    uint8_t bag_randomized[NUM_PIECES];
     for (size_t i = 0; i < NUM_PIECES; ++i) {
-        uint32_t index = rand() % (NUM_PIECES - i);
-        bag_randomized[i] = bag[index];
-        bag[index] = bag[NUM_PIECES - i - 1];
+        uint32_t index = bot_rand(rng) % (NUM_PIECES - i);
+        bag[i] = types[index];
+        types[index] = types[NUM_PIECES - i - 1];
     }
-    uint32_t init_holes = count_holes(matrix);
-    uint32_t init_line_deps = count_line_dep_cells(matrix, true);
+    return bot_rand(rng) % NUM_PIECES + 1;
+}
+
+/*
+ * Return whether the best placement of a piece satisfies the conditions in bot_next_piece on a
+ * matrix with features `init`.
+ */
+static bool bot_type_fits(const matrix_t* matrix, const features_t* init, const features_t* best) {
     uint32_t stack_height_limit;
     if (matrix->rows > 4) {
         stack_height_limit = matrix->rows - matrix->hidden_rows - 4;
     } else {
         stack_height_limit = matrix->rows - matrix->hidden_rows;
     }
-    int32_t tmp_err_value = 0;
-    uint8_t type = rand() % NUM_PIECES + 1; /* default value */
+    bool has_hole = best->holes > init->holes;
+    bool has_line_dep = best->line_dep_cells > init->line_dep_cells;
+    bool stack_too_high = best->stack_height > stack_height_limit;
+    return !has_hole && !has_line_dep && !stack_too_high;
+}
+
+static void bot_choose_task(void* data, uint32_t worker, uint32_t task) {
+    bot_choose_job_t* job = data;
+    uint32_t i = job->tasks[task];
+    job->err_value[i] = bot_search_type(&job->workers[worker], job->matrix, job->bag[i],
+                                        &job->best[i], &job->best_index[i]);
+}
+
+/*
+ * Start trying every type of `bag` at once on the bot's pool, each worker on its own scratch
+ * board. Only the types missing from the transposition table and the surface table are given to
+ * the pool, and the workers do not touch the tables themselves. `matrix` and `bag` must stay as
+ * they are until bot_choose_collect.
+ */
+static void bot_choose_dispatch(bot_t* bot, const matrix_t* matrix, const uint8_t* bag) {
+    bot_choose_job_t* job = &bot->choose_job;
+    job->workers = bot->workers;
+    job->matrix = matrix;
+    job->bag = bag;
+    job->num_tasks = 0;
     for (size_t i = 0; i < NUM_PIECES; ++i) {
-        tmp_err_value = bot_find_place(bot, matrix, bag_randomized[i]);
-        if (tmp_err_value != 0) {
-            *err_value = tmp_err_value;
-            return NULL;
+        job->err_value[i] = 0;
+        if (!bot_tt_probe(bot, matrix, bag[i], &job->best[i], &job->best_index[i])
+            && !bot_surface_probe(bot, matrix, bag[i], &job->best[i], &job->best_index[i])) {
+            job->tasks[job->num_tasks] = i;
+            ++job->num_tasks;
         }
-        bool has_hole = bot->holes > init_holes;
-        bool has_line_dep = bot->line_deps_cells > init_line_deps;
-        bool stack_too_high = bot->stack_height > stack_height_limit;
-        if (!has_hole && !has_line_dep && !stack_too_high) {
-            type = bag_randomized[i];
+    }
+    if (job->num_tasks > 0) {
+        pool_start(bot->pool, bot_choose_task, job, job->num_tasks);
+        job->running = true;
+    }
+}
+
+/* Stop the job of bot_choose_dispatch if the pool still has it, dropping its results. */
+static void bot_choose_cancel(bot_t* bot) {
+    if (bot->choose_job.running) {
+        pool_cancel(bot->pool);
+        bot->choose_job.running = false;
+    }
+}
+
+/*
+ * Finish the job started by bot_choose_dispatch and choose a type from its bag as described in
+ * bot_next_piece. The first type of the bag that fits is chosen, just as if the types were
+ * tried one after another, so the choice does not depend on how the work was spread. `type` holds
+ * the type to give if none fits. The chosen type is then looked up again to set up the bot's own
+ * scratch board. Return 0 on success or a non-zero value on failure.
+ */
+static int32_t bot_choose_collect(bot_t* bot, const features_t* init, uint8_t* type,
+                                  features_t* best, uint32_t* best_index) {
+    bot_choose_job_t* job = &bot->choose_job;
+    if (job->running) {
+        pool_wait(bot->pool);
+        job->running = false;
+    }
+    for (size_t i = 0; i < bot->num_workers; ++i) {
+        bot->scratch.features_evaluated += bot->workers[i].features_evaluated;
+        bot->scratch.features_skipped += bot->workers[i].features_skipped;
+        bot->workers[i].features_evaluated = 0;
+        bot->workers[i].features_skipped = 0;
+    }
+    for (size_t i = 0; i < job->num_tasks; ++i) {
+        uint32_t task = job->tasks[i];
+        if (job->err_value[task] != 0) {
+            return job->err_value[task];
+        }
+        bot_tt_store(bot, job->matrix, job->bag[task], &job->best[task],
+                     job->best_index[task]);
+    }
+    for (size_t i = 0; i < NUM_PIECES; ++i) {
+        if (bot_type_fits(job->matrix, init, &job->best[i])) {
+            *type = job->bag[i];
             break;
         }
     }
+    return bot_search_cached(bot, job->matrix, *type, best, best_index);
+}
 
-    piece_t* piece = piece_new(matrix, type);
-    if (!piece) {
-        *err_value = ERROR_PIECE;
+/*
+ * Choose the type of the next piece for `matrix` as described in bot_next_piece, taking random
+ * numbers from `rng`. The chosen piece is left on the bot's scratch board (see bot_search_cached),
+ * and its best placement is stored in `best` and `best_index` (see bot_search_type). Return 0 on
+ * success or a non-zero value on failure.
+ */
+static int32_t bot_choose_type(bot_t* bot, const matrix_t* matrix, uint32_t* rng, uint8_t* type,
+                               features_t* best, uint32_t* best_index) {
+    uint8_t bag[NUM_PIECES];
+    *type = bot_draw_bag(rng, bag); /* default value */
+    features_t init;
+    bot_evaluate(matrix, &init);
+    if (bot->pool) {
+        bot_choose_dispatch(bot, matrix, bag);
+        return bot_choose_collect(bot, &init, type, best, best_index);
     }
-    return piece;
+    for (size_t i = 0; i < NUM_PIECES; ++i) {
+        int32_t tmp_err_value = bot_search_cached(bot, matrix, bag[i], best, best_index);
+        if (tmp_err_value != 0) {
+            return tmp_err_value;
+        }
+        if (bot_type_fits(matrix, &init, best)) {
+            *type = bag[i];
+            return 0;
+        }
+    }
+    /* the placement must be for the piece that is actually given */
+    return bot_search_cached(bot, matrix, *type, best, best_index);
+}
+
+/*
+ * Start choosing the next piece for `matrix` without doing any of the work yet. Full rows are
+ * cleared from the bot's copy of the matrix, so this can be called right after piece_place while
+ * the line clear is still being animated. The work is then done by bot_step a bit at a time, and
+ * bot_spawn gives the chosen piece. Return 0 on success or a non-zero value on failure.
+ */
+int32_t bot_start(bot_t* bot, const matrix_t* matrix) {
+    bot_choose_cancel(bot);
+    if (!matrix_copy_table(&bot->board, matrix)) {
+        return ERROR_MATRIX_DIM_MISMATCH;
+    }
+    matrix_clean(&bot->board, NULL);
+    bot_evaluate(&bot->board, &bot->board_features);
+    bot->bag_type = bot_draw_bag(&bot->rng, bot->bag);
+    bot->bag_index = 0;
+    bot->scratch.features_evaluated = 0;
+    bot->scratch.features_skipped = 0;
+    bot->choosing = true;
+    bot->searching = false;
+    bot->search_pending = bot->search_depth > 1;
+    return 0;
+}
+
+/*
+ * Try the next piece type from the bag, as one step of choosing the piece started by bot_start.
+ * Return 0 on success or a non-zero value on failure.
+ */
+static int32_t bot_choose_step(bot_t* bot) {
+    if (bot->pool) {
+        /* the first step hands the whole bag to the pool, which marks every type as tried */
+        if (bot->bag_index == 0) {
+            bot_choose_dispatch(bot, &bot->board, bot->bag);
+            bot->bag_index = NUM_PIECES;
+            return 0;
+        }
+        /* then each step does one type on this thread, so a step is as long as without a pool */
+        if (bot->choose_job.running && pool_work_one(bot->pool)) {
+            return 0;
+        }
+        /* the threads are left with at most one type each */
+        features_t best;
+        uint32_t best_index;
+        int32_t tmp_err_value = bot_choose_collect(bot, &bot->board_features, &bot->bag_type,
+                                                   &best, &best_index);
+        if (tmp_err_value != 0) {
+            return tmp_err_value;
+        }
+        bot_set_dest(bot, best_index, &best);
+        bot->choosing = false;
+        return 0;
+    }
+    /* after the whole bag, the placement must be for the piece that is actually given */
+    bool bag_empty = bot->bag_index == NUM_PIECES;
+    uint8_t type = bag_empty ? bot->bag_type : bot->bag[bot->bag_index];
+    features_t best;
+    uint32_t best_index;
+    int32_t tmp_err_value = bot_search_cached(bot, &bot->board, type, &best, &best_index);
+    if (tmp_err_value != 0) {
+        return tmp_err_value;
+    }
+    if (!bag_empty && !bot_type_fits(&bot->board, &bot->board_features, &best)) {
+        ++bot->bag_index;
+        return 0;
+    }
+    bot->bag_type = type;
+    bot_set_dest(bot, best_index, &best);
+    bot->choosing = false;
+    return 0;
+}
+
+/*
+ * Work on what bot_start and bot_search_begin started for about `budget_ns` nanoseconds: first
+ * try the piece types one at a time until the next piece is chosen, then search ahead from it if
+ * `search_depth` is more than 1 (see bot_search_step). Like bot_search_step, a piece of work is
+ * only started if it is expected to end in time. Return 0 on success or a non-zero value on
+ * failure.
+ */
+int32_t bot_step(bot_t* bot, uint64_t budget_ns) {
+    uint64_t now = SDL_GetPerformanceCounter();
+    uint64_t deadline = now + budget_ns * SDL_GetPerformanceFrequency() / 1000000000;
+    if (bot->choosing) {
+        /* as in bot_search_step, so that a step slower than the budget does not stall the choice */
+        bot->expand_ticks_max -= bot->expand_ticks_max / 8;
+    }
+    while (bot->choosing && now + bot->expand_ticks_max < deadline) {
+        int32_t tmp_err_value = bot_choose_step(bot);
+        if (tmp_err_value != 0) {
+            return tmp_err_value;
+        }
+        uint64_t end = SDL_GetPerformanceCounter();
+        if (end - now > bot->expand_ticks_max) {
+            bot->expand_ticks_max = end - now;
+        }
+        now = end;
+    }
+    if (bot->choosing) {
+        return 0;
+    }
+    if (bot->search_pending && now + bot->expand_ticks_max < deadline) {
+        piece_t piece;
+        if (!piece_init(&piece, &bot->board, bot->bag_type)) {
+            return ERROR_PIECE;
+        }
+        int32_t tmp_err_value = bot_search_begin(bot, &bot->board, &piece);
+        if (tmp_err_value != 0) {
+            return tmp_err_value;
+        }
+    }
+    return bot_search_step(bot, deadline);
+}
+
+/* Return whether bot_step has nothing more to do. */
+bool bot_done(const bot_t* bot) {
+    return !bot->choosing && !bot->search_pending && bot_search_done(bot);
+}
+
+/*
+ * Set up `piece` as the piece chosen for the matrix given to bot_start. If the choice is not done
+ * yet, it is finished first. `matrix` should be that matrix with its full rows cleared. Return 0
+ * on success or a non-zero value on failure.
+ */
+int32_t bot_spawn(bot_t* bot, const matrix_t* matrix, piece_t* piece) {
+    while (bot->choosing) {
+        int32_t tmp_err_value = bot_choose_step(bot);
+        if (tmp_err_value != 0) {
+            return tmp_err_value;
+        }
+    }
+    if (!piece_init(piece, matrix, bot->bag_type)) {
+        return ERROR_PIECE;
+    }
+    return 0;
+}
+
+/*
+ * Set up `piece` as a piece that satisfies certain conditions:
+ * + The piece can be placed without making more holes in the stack.
+ * + The piece can be placed without creating more line dependencies.
+ * + The piece can be placed without making the stack too high.
+ *
+ * If there is no piece that satisfies these conditions, then use a random piece. This function
+ * may test the tetriminoes in random order. The random numbers come from the bot's own random
+ * state, which bot_new seeds with rand(), so that bot_search can tell which pieces will come
+ * next. Return 0 on success or a non-zero value on failure.
+ *
+ * `scratch.features_evaluated` and `scratch.features_skipped` count the features of every
+ * candidate placement tried for this piece, see bot_evaluate_better. With a pool (see
+ * bot_set_threads), every type in the bag is tried, so they count more than without one.
+ *
+ * The placement is the one bot_find_place would choose. This is bot_start and bot_spawn without
+ * waiting in between, so bot_step will then search ahead from the piece if `search_depth` is more
+ * than 1. The search can also be done at once with bot_search.
+ *
+ * See documentation on bot_find_place.
+ */
+int32_t bot_next_piece(bot_t* bot, const matrix_t* matrix, piece_t* piece) {
+    int32_t tmp_err_value = bot_start(bot, matrix);
+    if (tmp_err_value != 0) {
+        return tmp_err_value;
+    }
+    return bot_spawn(bot, matrix, piece);
 }
 
 /*
@@ -247,98 +792,295 @@ piece_t* bot_next_piece(bot_t* bot, const matrix_t* matrix, int32_t* err_value)
  *    stack.
  * 4. Stack as flat as possible.
  *
- * The point of the bot is to play humanely enough under certain conditions. This algorithm is
- * pretty simple. It cannot tuck in pieces under overhangs, nor can it do t-spins, or look at a
- * "next" queue. To prevent the bot from making inevitable mistakes, it should be given certain
- * pieces at certain times (cheat).
+ * The point of the bot is to play humanely enough under certain conditions. Every placement the
+ * piece can reach from spawn is tried, including tucks under overhangs and spins (see
+ * movegen_run), but only this piece is looked at; bot_search looks further ahead. To prevent the
+ * bot from making inevitable mistakes, it should be given certain pieces at certain times
+ * (cheat).
+ *
+ * If the piece can not be placed at all, the placement is reported as having UINT32_MAX holes.
  *
- * This function will allocate memory. Return 0 on success or a non-zero value on failure.
+ * Candidates are tried on the bot's scratch board, so this function does not allocate memory. The
+ * transposition table is looked in first, so a board that was seen before is not searched again.
+ * On a stack without holes, the placement is then looked up in the surface table if the bot has
+ * one (see surface_lookup), which gives the same placement without searching. Return 0 on
+ * success or a non-zero value on failure.
  */
 int32_t bot_find_place(bot_t* bot, const matrix_t* matrix, uint8_t piece_type) {
-    matrix_t* tmp_matrix = matrix_new(matrix->rows, matrix->cols, matrix->hidden_rows);
-    if (!tmp_matrix) {
-        return ERROR_MATRIX;
-    }
-    piece_t* tmp_piece = piece_new(tmp_matrix, piece_type);
-    if (!tmp_piece) {
-        return ERROR_PIECE;
+    features_t best;
+    uint32_t best_index;
+    int32_t tmp_err_value = bot_search_cached(bot, matrix, piece_type, &best, &best_index);
+    if (tmp_err_value != 0) {
+        return tmp_err_value;
     }
-    if (!matrix_copy_table(tmp_matrix, matrix)) {
-        return ERROR_MATRIX_DIM_MISMATCH;
+    bot_set_dest(bot, best_index, &best);
+    return 0;
+}
+
+/*
+ * Find a fingerprint of the placements the bot chooses: a hash of what bot_find_place gives every
+ * piece type on BOT_FINGERPRINT_BOARDS stacks spread over the surface signatures (see surface.h).
+ * A surface table made while the bot ranked placements differently has another fingerprint, so
+ * surface_open can refuse it. The surface table is not looked in, and the transposition table is
+ * cleared afterwards. Return 0 on success or a non-zero value on failure.
+ */
+int32_t bot_fingerprint(bot_t* bot, uint32_t* fingerprint) {
+    const matrix_t* matrix = &bot->scratch.matrix;
+    matrix_t board;
+    if (!matrix_init(&board, matrix->rows, matrix->cols, matrix->hidden_rows)) {
+        return ERROR_MATRIX;
     }
-    double lowest_dev = DBL_MAX;
-    uint32_t least_holes = UINT32_MAX;
-    uint32_t least_line_dep_cells = UINT32_MAX;
-    uint32_t least_in_rightmost_col = UINT32_MAX;
-    int32_t init_x = tmp_piece->x;
-    int32_t init_y = tmp_piece->y;
-    /* brute force, evaluate each x-coordinate and each rotation */
-    for (size_t i = 0; i < tmp_piece->orientations; ++i) {
-        tmp_piece->orient_index = i;
-        tmp_piece->x = init_x;
-        tmp_piece->y = init_y;
-        bool collides = false;
-        while (!collides) {
-            collides = !piece_move_left(tmp_piece, tmp_matrix);
+    uint32_t num_signatures = surface_num_signatures(matrix->cols, SURFACE_DEFAULT_MAX_DELTA);
+    const surface_table_t* surface = bot->surface;
+    bot->surface = NULL;
+    uint32_t hash = 2166136261u; /* FNV-1a */
+    int32_t err_value = 0;
+    for (uint32_t i = 0; i < BOT_FINGERPRINT_BOARDS && err_value == 0; ++i) {
+        uint32_t signature = (uint64_t)num_signatures * i / BOT_FINGERPRINT_BOARDS;
+        uint8_t heights[MATRIX_MAX_COLS];
+        if (!surface_heights(signature, board.rows, board.cols, SURFACE_DEFAULT_MAX_DELTA,
+                             heights)) {
+            continue;
+        }
+        matrix_fill(&board, heights, TYPE_O);
+        for (uint8_t type = 1; type <= NUM_PIECES && err_value == 0; ++type) {
+            err_value = bot_find_place(bot, &board, type);
+            uint32_t values[3] = { bot->dest_orient_index, bot->dest_x, bot->dest_y };
+            for (size_t v = 0; v < 3; ++v) {
+                hash = (hash ^ values[v]) * 16777619u;
+            }
         }
-        int32_t left_range = tmp_piece->x;
-        tmp_piece->x = init_x;
-        collides = 0;
-        while (!collides) {
-            collides = !piece_move_right(tmp_piece, tmp_matrix);
+    }
+    bot->surface = surface;
+    bot_clear_cache(bot);
+    *fingerprint = hash;
+    return err_value;
+}
+
+/*
+ * Try every placement of the scratch piece on the scratch board, and keep the best
+ * `width` of the resulting boards in `beam`, which holds `*size` boards sorted from best to
+ * worst. Each kept board remembers `root`, or the index of its own placement if `root` is
+ * UINT32_MAX. The placements are evaluated BATCH_MAX at a time (see bot_eval_batch), and the few
+ * that make it into the beam are placed again to copy their boards.
+ */
+static void bot_expand(bot_t* bot, uint32_t root, beam_node_t* beam, uint32_t* size,
+                       uint32_t width) {
+    matrix_t* tmp_matrix = &bot->scratch.matrix;
+    piece_t* tmp_piece = &bot->scratch.piece;
+    batch_t* batch = &bot->batch;
+    bot_generate(&bot->scratch);
+    uint32_t num_placements = bot->scratch.movegen.num_placements;
+    for (uint32_t first = 0; first < num_placements; first += BATCH_MAX) {
+        uint32_t last = first + BATCH_MAX < num_placements ? first + BATCH_MAX : num_placements;
+        for (uint32_t i = first; i < last; ++i) {
+            movegen_placement(&bot->scratch.movegen, i, tmp_piece);
+            matrix_undo_t undo;
+            piece_place_clean(tmp_piece, tmp_matrix, &undo);
+            batch_add(batch, tmp_matrix);
+            matrix_undo(tmp_matrix, &undo);
         }
-        int32_t right_range = tmp_piece->x;
-        for (int32_t x = left_range; x <= right_range; ++x) {
-            matrix_copy_table(tmp_matrix, matrix);
-            tmp_piece->x = x;
-            tmp_piece->y = init_y;
-            collides = 0;
-            while (!collides) {
-                collides = !piece_move_down(tmp_piece, tmp_matrix);
+        batch_run(batch);
+        for (uint32_t i = first; i < last; ++i) {
+            features_t features;
+            bot_batch_features(batch, i - first, &features);
+            ++bot->search_nodes;
+            /* ties keep the board found first, like bot_find_place */
+            uint32_t pos = *size;
+            while (pos > 0 && features_better(&features, &beam[pos - 1].features)) {
+                --pos;
             }
-            piece_place(tmp_piece, tmp_matrix);
-            matrix_clean(tmp_matrix);
-            /* evaluate the placement */
-            bool overwrite = false;
-            double dev = stack_deviation(tmp_matrix);
-            uint32_t holes = count_holes(tmp_matrix);
-            uint32_t line_dep_cells = count_line_dep_cells(tmp_matrix, true);
-            uint32_t in_rightmost_col = count_in_col(tmp_matrix, tmp_matrix->cols - 1);
-            overwrite = holes < least_holes;
-            if (holes == least_holes) {
-                overwrite = line_dep_cells < least_line_dep_cells;
-                if (line_dep_cells == least_line_dep_cells) {
-                    overwrite = in_rightmost_col < least_in_rightmost_col && holes == 0;
-                    if (in_rightmost_col == least_in_rightmost_col || holes > 0) {
-                        overwrite = dev < lowest_dev;
-                        if (dev == lowest_dev) {
-                            overwrite = in_rightmost_col < least_in_rightmost_col;
-                        }
-                    }
-                }
+            if (pos >= width) {
+                continue;
+            }
+            uint32_t kept = *size < width ? *size : width - 1;
+            memmove(&beam[pos + 1], &beam[pos], (kept - pos) * sizeof(beam_node_t));
+            if (*size < width) {
+                ++*size;
             }
+            movegen_placement(&bot->scratch.movegen, i, tmp_piece);
+            matrix_undo_t undo;
+            piece_place_clean(tmp_piece, tmp_matrix, &undo);
+            matrix_copy_table(&beam[pos].board, tmp_matrix);
+            matrix_undo(tmp_matrix, &undo);
+            beam[pos].features = features;
+            beam[pos].root = root == UINT32_MAX ? i : root;
+        }
+    }
+}
+
+/*
+ * Start choosing the placement of `piece` by looking ahead with a beam search. Every placement of
+ * the piece is tried here, and the best `beam_width` boards are kept as the first ply. Each call
+ * to bot_search_step then goes on with the search, and bot_search_finish makes the result the
+ * destination. The search can be stopped after any step, so it can be spread over the frames
+ * while the piece waits at spawn. If the piece has no placement, the destination is set here to
+ * where it spawned, as bot_find_place does.
+ *
+ * `search_nodes` counts the boards evaluated, `search_depth_reached` the pieces placed on the
+ * boards of the deepest complete ply, and `search_us` the time spent searching.
+ *
+ * `matrix` must not change until bot_search_finish is called. Searching does not allocate
+ * memory. Return 0 on success or a non-zero value on failure.
+ */
+int32_t bot_search_begin(bot_t* bot, const matrix_t* matrix, const piece_t* piece) {
+    uint64_t start = SDL_GetPerformanceCounter();
+    bot->search_width = bot->beam_width;
+    if (bot->search_width < 1) {
+        bot->search_width = 1;
+    } else if (bot->search_width > BOT_MAX_BEAM) {
+        bot->search_width = BOT_MAX_BEAM;
+    }
+    bot->search_nodes = 0;
+    bot->search_depth_reached = 0;
+    bot->search_ticks = 0;
+    bot->search_us = 0;
+    bot->search_type = piece->type;
+    bot->search_ply = 0;
+    bot->search_sizes[0] = 0;
+    bot->search_sizes[1] = 0;
+    bot->search_node = 0;
+    bot->search_rng = bot->rng;
+    bot->searching = false;
+    bot->search_pending = false;
+    features_t best;
+    uint32_t best_index;
+    int32_t tmp_err_value = bot_search_cached(bot, matrix, piece->type, &best, &best_index);
+    if (tmp_err_value != 0) {
+        return tmp_err_value;
+    }
+    if (best_index != UINT32_MAX) {
+        bot_expand(bot, UINT32_MAX, bot->beam[0], &bot->search_sizes[0], bot->search_width);
+        bot->search_depth_reached = 1;
+        bot->search_complete = bot->search_depth <= 1;
+        bot->searching = true;
+    } else {
+        bot_set_dest(bot, best_index, &best);
+    }
+    bot->search_ticks = SDL_GetPerformanceCounter() - start;
+    bot->search_us = bot->search_ticks * 1000000 / SDL_GetPerformanceFrequency();
+    return 0;
+}
+
+/* Return whether the search started by bot_search_begin has nothing more to do. */
+bool bot_search_done(const bot_t* bot) {
+    return !bot->searching || bot->search_complete;
+}
 
-            if (overwrite) {
-                lowest_dev = dev;
-                least_holes = holes;
-                least_line_dep_cells = line_dep_cells;
-                least_in_rightmost_col = in_rightmost_col;
-                bot->holes = holes;
-                bot->line_deps_cells = line_dep_cells;
-                bot->stack_height = get_stack_height(tmp_matrix);
-                bot->dest_orient_index = i;
-                bot->dest_x = x;
+/*
+ * Go on with the search started by bot_search_begin until it is done or `deadline` (a value of
+ * SDL_GetPerformanceCounter) is reached. For each board of the current ply, the piece that
+ * bot_next_piece would give next is chosen with a copy of the bot's random state, all of its
+ * placements are tried, and the best `beam_width` boards over the whole ply are kept as the next
+ * ply. A board is only expanded if the slowest expansion seen lately would still end before the
+ * deadline, so a step rarely runs over it. Return 0 on success or a non-zero value on failure.
+ */
+int32_t bot_search_step(bot_t* bot, uint64_t deadline) {
+    uint64_t start = SDL_GetPerformanceCounter();
+    uint64_t now = start;
+    /* forget a slow expansion little by little, so that one hiccup does not stall the search */
+    bot->expand_ticks_max -= bot->expand_ticks_max / 8;
+    while (!bot_search_done(bot) && now + bot->expand_ticks_max < deadline) {
+        uint32_t ply = bot->search_ply;
+        uint32_t next = 1 - ply;
+        beam_node_t* node = &bot->beam[ply][bot->search_node];
+        /* every board draws the same number of random numbers */
+        uint32_t rng = bot->search_rng;
+        uint8_t type;
+        features_t best;
+        uint32_t best_index;
+        int32_t tmp_err_value = bot_choose_type(bot, &node->board, &rng, &type, &best,
+                                                &best_index);
+        if (tmp_err_value != 0) {
+            return tmp_err_value;
+        }
+        bot_expand(bot, node->root, bot->beam[next], &bot->search_sizes[next], bot->search_width);
+        ++bot->search_node;
+        if (bot->search_node == bot->search_sizes[ply]) {
+            if (bot->search_sizes[next] == 0) {
+                /* no piece fits on any board, so the current ply stays the deepest */
+                bot->search_complete = true;
+            } else {
+                bot->search_ply = next;
+                bot->search_sizes[ply] = 0;
+                bot->search_node = 0;
+                bot->search_rng = rng;
+                ++bot->search_depth_reached;
+                bot->search_complete = bot->search_depth_reached >= bot->search_depth;
             }
         }
+        uint64_t end = SDL_GetPerformanceCounter();
+        if (end - now > bot->expand_ticks_max) {
+            bot->expand_ticks_max = end - now;
+        }
+        now = end;
     }
-    matrix_free(tmp_matrix);
-    piece_free(tmp_piece);
+    bot->search_ticks += now - start;
+    bot->search_us = bot->search_ticks * 1000000 / SDL_GetPerformanceFrequency();
     return 0;
 }
 
 /*
- * Update an array of inputs that will be made at a certain moment. The piece will always be moved
- * in the following order:
+ * Make the placement of the searched piece that leads to the best board of the deepest complete
+ * ply the destination. If bot_search_begin found no placement at all, it already made the piece
+ * stay where it spawned, so that is kept. Return 0 on success or a non-zero value on failure.
+ */
+int32_t bot_search_finish(bot_t* bot, const matrix_t* matrix) {
+    bot->search_pending = false;
+    if (!bot->searching) {
+        return 0;
+    }
+    bot->searching = false;
+    uint64_t start = SDL_GetPerformanceCounter();
+    /* the ply being expanded is incomplete, so its boards are ignored */
+    const beam_node_t* node = &bot->beam[bot->search_ply][0];
+    /* generate the placements of the piece again to get the path to the chosen placement */
+    features_t best;
+    uint32_t best_index;
+    int32_t tmp_err_value = bot_search_cached(bot, matrix, bot->search_type, &best, &best_index);
+    if (tmp_err_value != 0) {
+        return tmp_err_value;
+    }
+    matrix_t* tmp_matrix = &bot->scratch.matrix;
+    piece_t* tmp_piece = &bot->scratch.piece;
+    bot_generate(&bot->scratch);
+    movegen_placement(&bot->scratch.movegen, node->root, tmp_piece);
+    matrix_undo_t undo;
+    piece_place_clean(tmp_piece, tmp_matrix, &undo);
+    bot_evaluate(tmp_matrix, &best);
+    matrix_undo(tmp_matrix, &undo);
+    bot_set_dest(bot, node->root, &best);
+    bot->search_ticks += SDL_GetPerformanceCounter() - start;
+    bot->search_us = bot->search_ticks * 1000000 / SDL_GetPerformanceFrequency();
+    return 0;
+}
+
+/*
+ * Choose the placement of `piece` with a search of at most `search_depth` pieces that stops once
+ * `search_budget_us` microseconds have passed, see bot_search_begin. The first ply is always
+ * searched, so with a budget of 0 this is bot_find_place. Return 0 on success or a non-zero value
+ * on failure.
+ */
+int32_t bot_search(bot_t* bot, const matrix_t* matrix, const piece_t* piece) {
+    uint64_t deadline = SDL_GetPerformanceCounter()
+                        + (uint64_t)bot->search_budget_us * SDL_GetPerformanceFrequency() / 1000000;
+    int32_t tmp_err_value = bot_search_begin(bot, matrix, piece);
+    if (tmp_err_value != 0) {
+        return tmp_err_value;
+    }
+    tmp_err_value = bot_search_step(bot, deadline);
+    if (tmp_err_value != 0) {
+        return tmp_err_value;
+    }
+    return bot_search_finish(bot, matrix);
+}
+
+/*
+ * Update an array of inputs that will be made at a certain moment. The piece follows the path of
+ * moves found by bot_find_place, and is moved down once it reaches the end of the path so that it
+ * locks.
+ *
+ * If the piece is not on the path, it will be moved in the following order instead:
  * 1. Rotate the piece to the desired orientation.
  * 2. Move the piece to the desired columns.
  * 3. Move the piece down until it is placed on the stack.
@@ -348,6 +1090,20 @@ int32_t bot_find_place(bot_t* bot, const matrix_t* matrix, uint8_t piece_type) {
  */
 void bot_update_inputs(bot_t* bot, inputs_t* inputs, const piece_t* piece) {
     inputs_clear(inputs);
+    uint32_t state = movegen_state(piece);
+    for (size_t i = 0; i <= bot->path_len; ++i) {
+        if (bot->path_states[i] != state) {
+            continue;
+        }
+        uint8_t move = i < bot->path_len ? bot->path[i] : MOVE_DOWN;
+        inputs->cw = move == MOVE_CW;
+        inputs->ccw = move == MOVE_CCW;
+        inputs->left = move == MOVE_LEFT;
+        inputs->right = move == MOVE_RIGHT;
+        inputs->down = move == MOVE_DOWN;
+        return;
+    }
+
     int64_t x = piece->orient_index;
     int64_t d = bot->dest_orient_index;
     if (x != d) {
@@ -371,3 +1127,71 @@ void bot_update_inputs(bot_t* bot, inputs_t* inputs, const piece_t* piece) {
         inputs->down = true;
     }
 }
+
+/*
+ * Choose pieces with a pool of `num_threads` threads besides the calling one, or without a pool
+ * if `num_threads` is 0. With a pool, every type of the bag is tried at once (see
+ * bot_choose_dispatch), which gives the same pieces and placements as without one. A choice that
+ * bot_start began is started over. Return 0 on success or a non-zero value on failure, in which
+ * case the bot has no pool.
+ */
+int32_t bot_set_threads(bot_t* bot, uint32_t num_threads) {
+    bot_choose_cancel(bot);
+    pool_free(bot->pool);
+    SDL_free(bot->workers);
+    bot->pool = NULL;
+    bot->workers = NULL;
+    bot->num_workers = 0;
+    /* a choice that was handed to the old pool starts over */
+    bot->bag_index = 0;
+    if (num_threads == 0) {
+        return 0;
+    }
+    bot->workers = SDL_malloc((num_threads + 1) * sizeof(bot_scratch_t));
+    if (!bot->workers) {
+        return ERROR_BOT;
+    }
+    const matrix_t* matrix = &bot->scratch.matrix;
+    for (size_t i = 0; i <= num_threads; ++i) {
+        if (!matrix_init(&bot->workers[i].matrix, matrix->rows, matrix->cols,
+                         matrix->hidden_rows)) {
+            SDL_free(bot->workers);
+            bot->workers = NULL;
+            return ERROR_MATRIX;
+        }
+        bot->workers[i].features_evaluated = 0;
+        bot->workers[i].features_skipped = 0;
+    }
+    bot->pool = pool_new(num_threads);
+    if (!bot->pool) {
+        SDL_free(bot->workers);
+        bot->workers = NULL;
+        return ERROR_BOT;
+    }
+    bot->num_workers = num_threads + 1;
+    return 0;
+}
+
+/*
+ * Forget every placement in the transposition table and reset `tt_probes` and `tt_hits`, which
+ * count the lookups and the lookups that found their board since then, and `surface_hits`, which
+ * counts the placements taken from the surface table.
+ */
+void bot_clear_cache(bot_t* bot) {
+    for (size_t i = 0; i < BOT_TT_SIZE; ++i) {
+        bot->tt[i].used = false;
+    }
+    bot->tt_probes = 0;
+    bot->tt_hits = 0;
+    bot->surface_hits = 0;
+}
+
+void bot_free(bot_t* bot) {
+    if (!bot) {
+        return;
+    }
+    bot_choose_cancel(bot);
+    pool_free(bot->pool);
+    SDL_free(bot->workers);
+    SDL_free(bot);
+}
@@ -23,9 +23,14 @@
  */
 
 #if !defined(BOT_H)
+#define BOT_H
 
 #include <stdbool.h>
 #include "matrix.h"
+#include "batch.h"
+#include "movegen.h"
+#include "pool.h"
+#include "surface.h"
 
 typedef struct {
     bool left;
@@ -37,17 +42,144 @@ typedef struct {
 
 void inputs_clear(inputs_t* inputs);
 
+/* What the bot looks at when it ranks placements. See bot_evaluate. */
 typedef struct {
+    uint32_t holes;
+    uint32_t line_dep_cells;
+    uint32_t in_rightmost_col;
+    uint32_t stack_height;
+    int64_t spread;
+} features_t;
+
+enum {
+    BOT_MAX_BEAM = 16,
+    BOT_DEFAULT_BEAM = 4,
+    BOT_TT_BITS = 12,
+    BOT_TT_SIZE = 1 << BOT_TT_BITS,
+    BOT_FINGERPRINT_BOARDS = 64, /* stacks the placements are hashed on, see bot_fingerprint */
+};
+
+/*
+ * The best placement of a piece type on a board, as remembered by the transposition table. The
+ * features are narrowed so that an entry fits in 32 bytes.
+ */
+typedef struct {
+    uint64_t key; /* hash of the board mixed with the piece type, see bot_tt_key */
+    int64_t spread;
+    uint32_t holes;
+    uint32_t line_dep_cells;
+    uint16_t in_rightmost_col;
+    uint16_t best_index; /* UINT16_MAX if the piece can not be placed */
+    uint8_t stack_height;
+    bool used;
+} bot_tt_entry_t;
+
+/* What a thread needs to try placements without allocating memory. */
+typedef struct {
+    matrix_t matrix; /* board that candidate placements are tried on */
+    piece_t piece;
+    movegen_t movegen;
+    bool generated; /* whether the move generator holds the placements of `piece` on `matrix` */
+    piece_t surface_piece; /* placement found in the surface table, see bot_surface_probe */
+    /* features evaluated and skipped while choosing the last piece, see bot_next_piece */
+    uint32_t features_evaluated;
+    uint32_t features_skipped;
+} bot_scratch_t;
+
+/* The piece types tried at once on the bot's pool, see bot_choose_dispatch. */
+typedef struct {
+    bot_scratch_t* workers;
+    const matrix_t* matrix;
+    const uint8_t* bag;
+    uint8_t tasks[NUM_PIECES]; /* indices into `bag` of the types not in the transposition table */
+    uint32_t num_tasks;
+    features_t best[NUM_PIECES];
+    uint32_t best_index[NUM_PIECES];
+    int32_t err_value[NUM_PIECES];
+    bool running; /* the pool has the tasks, and bot_choose_collect has not waited for them yet */
+} bot_choose_job_t;
+
+/* A board kept by bot_search. */
+typedef struct {
+    matrix_t board;
+    features_t features;
+    uint32_t root; /* placement of the searched piece that the board comes from */
+} beam_node_t;
+
+typedef struct {
+    bot_scratch_t scratch;
+    uint8_t path[MOVEGEN_MAX_STATES]; /* moves to the chosen placement */
+    uint16_t path_states[MOVEGEN_MAX_STATES + 1]; /* see movegen_path */
+    uint32_t path_len;
     uint32_t holes;
     uint32_t line_deps_cells;
     uint32_t stack_height;
     uint32_t dest_orient_index;
     int32_t dest_x;
+    int32_t dest_y;
+    uint32_t rng; /* random state used to choose pieces, see bot_next_piece */
+    /* lookahead settings, see bot_search */
+    uint32_t search_depth;
+    uint32_t beam_width;
+    uint32_t search_budget_us;
+    /* nodes, depth and time of the last search */
+    uint32_t search_nodes;
+    uint32_t search_depth_reached;
+    uint32_t search_us;
+    /* search in progress, see bot_search_begin */
+    beam_node_t beam[2][BOT_MAX_BEAM];
+    uint32_t search_sizes[2];
+    uint32_t search_ply; /* index of the beam that holds the deepest complete ply */
+    uint32_t search_node; /* next board of that ply to expand */
+    uint32_t search_width;
+    uint32_t search_rng; /* random state for choosing the pieces of the next ply */
+    uint64_t search_ticks;
+    uint64_t expand_ticks_max; /* slowest recent expansion of a board, see bot_search_step */
+    uint8_t search_type;
+    bool searching;
+    bool search_complete;
+    bool search_pending; /* bot_step will start a search once the piece is chosen */
+    /* piece being chosen, see bot_start */
+    matrix_t board;
+    features_t board_features;
+    uint8_t bag[NUM_PIECES];
+    uint8_t bag_index; /* next type of the bag to try */
+    uint8_t bag_type; /* chosen type, or the type to give if none in the bag fits */
+    bool choosing;
+    /* threads that try piece types at once, see bot_set_threads */
+    pool_t* pool;
+    bot_scratch_t* workers; /* one for each thread of the pool and one for the calling thread */
+    uint32_t num_workers;
+    bot_choose_job_t choose_job;
+    /* best placements found so far, see bot_search_cached */
+    bot_tt_entry_t tt[BOT_TT_SIZE];
+    uint64_t tt_probes;
+    uint64_t tt_hits;
+    batch_t batch; /* boards evaluated at once by bot_expand, see bot_eval_batch */
+    /* placements made ahead of time for stacks without holes, NULL if there is no table */
+    const surface_table_t* surface;
+    uint64_t surface_hits;
 } bot_t;
 
-bot_t    bot_new(void);
-piece_t* bot_next_piece(bot_t* bot, const matrix_t* matrix, int32_t* err_value);
-int32_t  bot_find_place(bot_t* bot, const matrix_t* matrix, uint8_t piece_type);
-void     bot_update_inputs(bot_t* bot, inputs_t* inputs, const piece_t* piece);
+bot_t*  bot_new(const matrix_t* matrix);
+int32_t bot_next_piece(bot_t* bot, const matrix_t* matrix, piece_t* piece);
+int32_t bot_start(bot_t* bot, const matrix_t* matrix);
+int32_t bot_step(bot_t* bot, uint64_t budget_ns);
+bool    bot_done(const bot_t* bot);
+int32_t bot_spawn(bot_t* bot, const matrix_t* matrix, piece_t* piece);
+int32_t bot_find_place(bot_t* bot, const matrix_t* matrix, uint8_t piece_type);
+int32_t bot_fingerprint(bot_t* bot, uint32_t* fingerprint);
+int32_t bot_search(bot_t* bot, const matrix_t* matrix, const piece_t* piece);
+int32_t bot_search_begin(bot_t* bot, const matrix_t* matrix, const piece_t* piece);
+int32_t bot_search_step(bot_t* bot, uint64_t deadline);
+bool    bot_search_done(const bot_t* bot);
+int32_t bot_search_finish(bot_t* bot, const matrix_t* matrix);
+void    bot_evaluate(const matrix_t* matrix, features_t* features);
+void    bot_eval_batch(bot_t* bot, const matrix_t* const* boards, uint32_t num_boards,
+                       features_t* features);
+void    bot_update_inputs(bot_t* bot, inputs_t* inputs, const piece_t* piece);
+int32_t bot_set_threads(bot_t* bot, uint32_t num_threads);
+void    bot_clear_cache(bot_t* bot);
+void    bot_free(bot_t* bot);
 
 #endif /* BOT_H */
@@ -40,6 +40,9 @@ enum {
     ERROR_MATRIX_DIM_MISMATCH,
     ERROR_FEW_ARGUMENTS,
     ERROR_UNKNOWN_ARGUMENT,
+    ERROR_BENCH_CHECK, /* a check made by the benchmarks failed */
+    ERROR_SURFACE, /* the surface table could not be allocated */
+    ERROR_SURFACE_WRITE, /* the surface table could not be written to its file */
 };
 
 #endif /* ERRORVALUES_H */
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2024-2025 Oxoboo
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE
+ * AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+#include "SDL_cpuinfo.h"
+#include "fill.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FILL_X86
+#include <immintrin.h>
+/* as in batch.c, the kernels are compiled for their instruction sets and checked for at run time */
+#if defined(__GNUC__)
+#define FILL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define FILL_TARGET(isa)
+#endif
+#endif
+
+enum {
+    /*
+     * Fills of at least this many bytes bypass the cache. Smaller ones stay in it, where streaming
+     * is slower than ordinary stores, see bench_fill.
+     */
+    FILL_STREAM_BYTES = 16 << 20,
+};
+
+static void fill_scalar(uint32_t* dest, uint32_t pixel, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        dest[i] = pixel;
+    }
+}
+
+#if defined(FILL_X86)
+
+/*
+ * Return how many pixels to set one at a time before `dest` is aligned to `align` bytes, or
+ * `count` if that is all of them. Pixels are aligned to their size, so this is always possible.
+ */
+static size_t fill_head(const uint32_t* dest, size_t count, size_t align) {
+    size_t head = ((align - (uintptr_t)dest % align) % align) / sizeof(uint32_t);
+    return head < count ? head : count;
+}
+
+/*
+ * 4 pixels per store. Rows need not be aligned, and the last few pixels are set one at a time.
+ * Fills bigger than the cache bypass it, which saves reading each line before it is written.
+ */
+FILL_TARGET("sse2")
+static void fill_sse2(uint32_t* dest, uint32_t pixel, size_t count) {
+    const __m128i value = _mm_set1_epi32((int32_t)pixel);
+    size_t i = 0;
+    if (count * sizeof(pixel) >= FILL_STREAM_BYTES) {
+        i = fill_head(dest, count, sizeof(value));
+        fill_scalar(dest, pixel, i);
+        for (; i + 4 <= count; i += 4) {
+            _mm_stream_si128((__m128i*)&dest[i], value);
+        }
+        _mm_sfence();
+    }
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_si128((__m128i*)&dest[i], value);
+    }
+    fill_scalar(dest + i, pixel, count - i);
+}
+
+/* fill_sse2 with 8 pixels per store, one row of a block. */
+FILL_TARGET("avx2")
+static void fill_avx2(uint32_t* dest, uint32_t pixel, size_t count) {
+    const __m256i value = _mm256_set1_epi32((int32_t)pixel);
+    size_t i = 0;
+    if (count * sizeof(pixel) >= FILL_STREAM_BYTES) {
+        i = fill_head(dest, count, sizeof(value));
+        fill_scalar(dest, pixel, i);
+        for (; i + 8 <= count; i += 8) {
+            _mm256_stream_si256((__m256i*)&dest[i], value);
+        }
+        _mm_sfence();
+    }
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_si256((__m256i*)&dest[i], value);
+    }
+    fill_scalar(dest + i, pixel, count - i);
+}
+
+#endif
+
+/*
+ * Return kernel `kind` (FILL_SCALAR, FILL_SSE2 or FILL_AVX2), or NULL if this CPU can not run it.
+ */
+fill_kernel_t fill_get_kernel(uint32_t kind) {
+    if (kind == FILL_SCALAR) {
+        return fill_scalar;
+    }
+#if defined(FILL_X86)
+    if (kind == FILL_SSE2 && SDL_HasSSE2()) {
+        return fill_sse2;
+    } else if (kind == FILL_AVX2 && SDL_HasAVX2()) {
+        return fill_avx2;
+    }
+#endif
+    return NULL;
+}
+
+/* Return the kind of the widest kernel that this CPU can run. */
+uint32_t fill_best_kind(void) {
+    static const uint32_t kinds[] = { FILL_AVX2, FILL_SSE2 };
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); ++i) {
+        if (fill_get_kernel(kinds[i])) {
+            return kinds[i];
+        }
+    }
+    return FILL_SCALAR;
+}
+
+/*
+ * Set a rectangle of `width` by `height` pixels to `pixel`, with `dest` at its top-left corner in
+ * an image with rows `pitch` bytes apart. Rows with no gap between them are filled as one.
+ */
+void fill_rect(fill_kernel_t kernel, uint8_t* dest, int32_t pitch,
+               uint32_t width, uint32_t height, uint32_t pixel) {
+    if ((size_t)pitch == width * sizeof(uint32_t)) {
+        kernel((uint32_t*)dest, pixel, (size_t)width * height);
+        return;
+    }
+    for (uint32_t y = 0; y < height; ++y) {
+        kernel((uint32_t*)(dest + y * pitch), pixel, width);
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2024-2025 Oxoboo
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE
+ * AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+#ifndef FILL_H
+#define FILL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Kernels that set `count` 32-bit pixels in a row to the same value, with the widest stores the
+ * CPU has. They only beat copying a tile to every cell once the image is too big for the cache,
+ * as large as a wall of screens. The game's texture is far smaller, so graphics.c copies tiles
+ * and the screensaver does not use these. They are only built into /b, to compare with the
+ * tiles, by `make BENCH_FILL=1` (see bench_fill).
+ */
+enum {
+    FILL_SCALAR,
+    FILL_SSE2,
+    FILL_AVX2,
+    NUM_FILL_KERNELS,
+};
+
+typedef void (*fill_kernel_t)(uint32_t* dest, uint32_t pixel, size_t count);
+
+fill_kernel_t fill_get_kernel(uint32_t kind);
+uint32_t      fill_best_kind(void);
+void          fill_rect(fill_kernel_t kernel, uint8_t* dest, int32_t pitch,
+                        uint32_t width, uint32_t height, uint32_t pixel);
+
+#endif /* FILL_H */
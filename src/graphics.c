@@ -27,8 +27,6 @@
 #include "graphics.h"
 
 enum {
-    BLOCK_WIDTH = 8,
-    BLOCK_HEIGHT = 8,
     NUM_PALLETES = 10,
 };
 
@@ -114,6 +112,14 @@ const uint8_t COLORS_CURTAIN[BLOCK_HEIGHT][BLOCK_WIDTH] = {
     { COLOR_B, COLOR_B, COLOR_B, COLOR_B, COLOR_B, COLOR_B, COLOR_B, COLOR_B },
 };
 
+/* the colors of each tile up to the backgrounds, indexed by TILE_BLOCK1 and so on */
+const uint8_t (*const TILE_COLORS[TILE_GRAY])[BLOCK_WIDTH] = {
+    PIXELS_BLOCK1,
+    PIXELS_BLOCK2,
+    PIXELS_BLOCK3,
+    COLORS_CURTAIN,
+};
+
 /*
  * Convert a tetromino's values to the values of its corresponding NES Tetris counterpart. Return
  * a 0, 1, or 2. If `type` is an invalid value, return a 0 anyway.
@@ -159,12 +165,16 @@ graphics_t* graphics_new(SDL_Renderer* renderer, const matrix_t* matrix) {
     );
     SDL_SetTextureBlendMode(graphics->texture, SDL_BLENDMODE_BLEND);
     graphics->size = sizeof(uint8_t) * graphics_texture_size(matrix) * BYTES_PER_PIXEL;
-    graphics->pixels = malloc(graphics->size);
-    if (!graphics->pixels) {
-        free(graphics);
-        return NULL;
-    }
+    /* the cells are drawn straight into the texture, see graphics_update_texture */
+    graphics->pixels = NULL;
     graphics->pallete_value = 0;
+    graphics->tiles_pallete = UINT32_MAX;
+    graphics->rows = matrix->rows - matrix->hidden_rows;
+    graphics->cols = matrix->cols;
+    memset(graphics->cells, TILE_CLEAR, sizeof(graphics->cells));
+    memset(graphics->drawn, TILE_UNDRAWN, sizeof(graphics->drawn));
+    graphics->upload_bytes = 0;
+    graphics->upload_total = 0;
     return graphics;
 }
 
@@ -180,126 +190,72 @@ uint32_t graphics_texture_size(const matrix_t* matrix) {
     return (graphics_texture_width(matrix) * graphics_texture_height(matrix));
 }
 
-void graphics_cell(graphics_t* graphics, const matrix_t* matrix,
-                   uint8_t type, uint32_t row, uint32_t col) {
-    uint32_t p_index = graphics->pallete_value % NUM_PALLETES;
-    const uint8_t (*pixels)[BLOCK_HEIGHT][BLOCK_WIDTH];
-    switch (type_to_nes_type(type)) {
-        case 0:
-            pixels = &PIXELS_BLOCK1;
-            break;
-        case 1:
-            pixels = &PIXELS_BLOCK2;
-            break;
-        case 2:
-            pixels = &PIXELS_BLOCK3;
-            break;
-        default:
-            pixels = &PIXELS_BLOCK1;
-            break;
-    }
-
-    uint32_t pixels_per_row = matrix->cols * BLOCK_WIDTH * BLOCK_HEIGHT;
-    for (size_t y = 0; y < BLOCK_HEIGHT; ++y) {
-        for (size_t x = 0; x < BLOCK_WIDTH; ++x) {
-            uint32_t index = ((pixels_per_row * (row - matrix->hidden_rows))
-                + (col * BLOCK_WIDTH)
-                + (matrix->cols * BLOCK_WIDTH * y) + x)
-                * BYTES_PER_PIXEL;
-            switch ((*pixels)[y][x]) {
-                case COLOR_1:
-                    graphics->pixels[index] = DEFAULT_ALPHA;
-                    graphics->pixels[index + 1] = PALLETE[p_index].color1[INDEX_BLUE];
-                    graphics->pixels[index + 2] = PALLETE[p_index].color1[INDEX_GREEN];
-                    graphics->pixels[index + 3] = PALLETE[p_index].color1[INDEX_RED];
-                    break;
-                case COLOR_2:
-                    graphics->pixels[index] = DEFAULT_ALPHA;
-                    graphics->pixels[index + 1] = PALLETE[p_index].color2[INDEX_BLUE];
-                    graphics->pixels[index + 2] = PALLETE[p_index].color2[INDEX_GREEN];
-                    graphics->pixels[index + 3] = PALLETE[p_index].color2[INDEX_RED];
-                    break;
-                case COLOR_W:
-                    graphics->pixels[index] = DEFAULT_ALPHA;
-                    graphics->pixels[index + 1] = 0xFF;
-                    graphics->pixels[index + 2] = 0xFF;
-                    graphics->pixels[index + 3] = 0xFF;
-                    break;
-                case COLOR_B:
-                    graphics->pixels[index] = DEFAULT_ALPHA;
-                    graphics->pixels[index + 1] = 0x00;
-                    graphics->pixels[index + 2] = 0x00;
-                    graphics->pixels[index + 3] = 0x00;
-                    break;
-                default:
-                    break;
-            }
-        }
-    }
+/* Return an RGBA8888 pixel, which keeps red in the highest byte and alpha in the lowest. */
+static uint32_t rgba_pixel(uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha) {
+    return (uint32_t)red << 24 | (uint32_t)green << 16 | (uint32_t)blue << 8 | alpha;
 }
 
-void graphics_curtain(graphics_t* graphics, const matrix_t* matrix, uint32_t row) {
+/*
+ * Make the tiles again if the pallete has changed since they were made. Every cell is then drawn
+ * again by the next graphics_render. Drawing a cell is just copying the rows of its tile.
+ */
+static void graphics_update_tiles(graphics_t* graphics) {
     uint32_t p_index = graphics->pallete_value % NUM_PALLETES;
-    uint32_t pixels_per_row = matrix->cols * BLOCK_WIDTH * BLOCK_HEIGHT;
-    for (size_t col = 0; col < matrix->cols; ++col) {
+    if (graphics->tiles_pallete != p_index) {
+        const pallete_t* pallete = &PALLETE[p_index];
+        uint32_t colors[4];
+        colors[COLOR_B] = rgba_pixel(0x00, 0x00, 0x00, DEFAULT_ALPHA);
+        colors[COLOR_1] = rgba_pixel(pallete->color1[INDEX_RED], pallete->color1[INDEX_GREEN],
+                                     pallete->color1[INDEX_BLUE], DEFAULT_ALPHA);
+        colors[COLOR_2] = rgba_pixel(pallete->color2[INDEX_RED], pallete->color2[INDEX_GREEN],
+                                     pallete->color2[INDEX_BLUE], DEFAULT_ALPHA);
+        colors[COLOR_W] = rgba_pixel(0xFF, 0xFF, 0xFF, DEFAULT_ALPHA);
+        uint32_t gray = rgba_pixel(BG_GRAY, BG_GRAY, BG_GRAY, DEFAULT_ALPHA);
         for (size_t y = 0; y < BLOCK_HEIGHT; ++y) {
             for (size_t x = 0; x < BLOCK_WIDTH; ++x) {
-                uint32_t index = ((pixels_per_row * (row - matrix->hidden_rows))
-                    + (col * BLOCK_WIDTH)
-                    + (matrix->cols * BLOCK_WIDTH * y) + x)
-                    * BYTES_PER_PIXEL;
-                switch (COLORS_CURTAIN[y][x]) {
-                    case COLOR_1:
-                        graphics->pixels[index] = DEFAULT_ALPHA;
-                        graphics->pixels[index + 1] = PALLETE[p_index].color1[INDEX_BLUE];
-                        graphics->pixels[index + 2] = PALLETE[p_index].color1[INDEX_GREEN];
-                        graphics->pixels[index + 3] = PALLETE[p_index].color1[INDEX_RED];
-                        break;
-                    case COLOR_2:
-                        graphics->pixels[index] = DEFAULT_ALPHA;
-                        graphics->pixels[index + 1] = PALLETE[p_index].color2[INDEX_BLUE];
-                        graphics->pixels[index + 2] = PALLETE[p_index].color2[INDEX_GREEN];
-                        graphics->pixels[index + 3] = PALLETE[p_index].color2[INDEX_RED];
-                        break;
-                    case COLOR_W:
-                        graphics->pixels[index] = DEFAULT_ALPHA;
-                        graphics->pixels[index + 1] = 0xFF;
-                        graphics->pixels[index + 2] = 0xFF;
-                        graphics->pixels[index + 3] = 0xFF;
-                        break;
-                    case COLOR_B:
-                        graphics->pixels[index] = DEFAULT_ALPHA;
-                        graphics->pixels[index + 1] = 0x00;
-                        graphics->pixels[index + 2] = 0x00;
-                        graphics->pixels[index + 3] = 0x00;
-                        break;
-                    default:
-                        break;
+                for (size_t t = 0; t < TILE_GRAY; ++t) {
+                    graphics->tiles[t][y][x] = colors[TILE_COLORS[t][y][x]];
                 }
+                graphics->tiles[TILE_GRAY][y][x] = gray;
+                graphics->tiles[TILE_CLEAR][y][x] = 0;
             }
         }
+        graphics->tiles_pallete = p_index;
+        memset(graphics->drawn, TILE_UNDRAWN, sizeof(graphics->drawn));
+    }
+}
+
+/*
+ * Copy a tile to the pixels at `dest`, the top-left corner of a cell in an image with rows
+ * `pitch` bytes apart.
+ */
+static void graphics_tile_copy(const graphics_t* graphics, uint32_t tile, uint8_t* dest,
+                               int32_t pitch) {
+    for (size_t y = 0; y < BLOCK_HEIGHT; ++y) {
+        memcpy(dest + y * pitch, graphics->tiles[tile][y], sizeof(graphics->tiles[tile][y]));
     }
 }
 
+void graphics_cell(graphics_t* graphics, const matrix_t* matrix,
+                   uint8_t type, uint32_t row, uint32_t col) {
+    graphics->cells[row - matrix->hidden_rows][col] = TILE_BLOCK1 + type_to_nes_type(type);
+}
+
+void graphics_curtain(graphics_t* graphics, const matrix_t* matrix, uint32_t row) {
+    memset(graphics->cells[row - matrix->hidden_rows], TILE_CURTAIN, matrix->cols);
+}
+
 /* Fill pixel data with a gray (or black) color. */
 void graphics_clear_gray(graphics_t* graphics, const matrix_t* matrix) {
-    uint32_t size = graphics_texture_size(matrix);
-    for (size_t i = 0; i < size; ++i) {
-        graphics->pixels[i * BYTES_PER_PIXEL] = DEFAULT_ALPHA;
-        graphics->pixels[i * BYTES_PER_PIXEL + 1] = BG_GRAY;
-        graphics->pixels[i * BYTES_PER_PIXEL + 2] = BG_GRAY;
-        graphics->pixels[i * BYTES_PER_PIXEL + 3] = BG_GRAY;
+    for (size_t r = 0; r < matrix->rows - matrix->hidden_rows; ++r) {
+        memset(graphics->cells[r], TILE_GRAY, matrix->cols);
     }
 }
 
 /* Fill pixel data with a fully transparent color. */
 void graphics_clear(graphics_t* graphics, const matrix_t* matrix) {
-    uint32_t size = graphics_texture_size(matrix);
-    for (size_t i = 0; i < size; ++i) {
-        graphics->pixels[i * BYTES_PER_PIXEL] = 0x00;
-        graphics->pixels[i * BYTES_PER_PIXEL + 1] = 0x00;
-        graphics->pixels[i * BYTES_PER_PIXEL + 2] = 0x00;
-        graphics->pixels[i * BYTES_PER_PIXEL + 3] = 0x00;
+    for (size_t r = 0; r < matrix->rows - matrix->hidden_rows; ++r) {
+        memset(graphics->cells[r], TILE_CLEAR, matrix->cols);
     }
 }
 
@@ -316,15 +272,13 @@ void graphics_matrix(graphics_t* graphics, const matrix_t* matrix) {
 }
 
 void graphics_piece(graphics_t* graphics, const piece_t* piece, const matrix_t* matrix) {
-    const uint8_t (*table)[piece->orientations][piece->rows][piece->cols] = (const uint8_t(*)[piece->orientations][piece->rows][piece->cols])piece->table;
-    for (size_t r = 0; r < piece->rows; ++r) {
-        for (size_t c = 0; c < piece->cols; ++c) {
-            uint8_t type = (*table)[piece->orient_index][r][c];
-            if (type == TYPE_NONE || piece->y + r < matrix->hidden_rows) {
-                continue;
-            }
-            graphics_cell(graphics, matrix, type, piece->y + r, piece->x + c);
+    const shape_t* shape = piece_shape(piece);
+    for (size_t i = 0; i < 4; ++i) {
+        int64_t row = (int64_t)piece->y + shape->cells[i][0];
+        if (row < matrix->hidden_rows) {
+            continue;
         }
+        graphics_cell(graphics, matrix, piece->type, row, piece->x + shape->cells[i][1]);
     }
 }
 
@@ -388,6 +342,138 @@ void graphics_curtain3(graphics_t* graphics, const matrix_t* matrix,
     }
 }
 
+/*
+ * Find the smallest rectangle of the texture, in pixels, that holds every cell that changed since
+ * it was last drawn. Return false if no cell changed.
+ */
+static bool graphics_dirty_rect(const graphics_t* graphics, SDL_Rect* rect) {
+    uint32_t min_row = UINT32_MAX;
+    uint32_t max_row = 0;
+    uint32_t min_col = UINT32_MAX;
+    uint32_t max_col = 0;
+    for (uint32_t r = 0; r < graphics->rows; ++r) {
+        for (uint32_t c = 0; c < graphics->cols; ++c) {
+            if (graphics->cells[r][c] == graphics->drawn[r][c]) {
+                continue;
+            }
+            min_row = r < min_row ? r : min_row;
+            max_row = r > max_row ? r : max_row;
+            min_col = c < min_col ? c : min_col;
+            max_col = c > max_col ? c : max_col;
+        }
+    }
+    if (min_row == UINT32_MAX) {
+        return false;
+    }
+    rect->x = min_col * BLOCK_WIDTH;
+    rect->y = min_row * BLOCK_HEIGHT;
+    rect->w = (max_col - min_col + 1) * BLOCK_WIDTH;
+    rect->h = (max_row - min_row + 1) * BLOCK_HEIGHT;
+    return true;
+}
+
+/*
+ * Lock a rectangle of the texture and draw its cells straight into it. The locked pixels are not
+ * guaranteed to hold what the texture showed, so every cell in the rectangle is drawn, not only
+ * the ones that changed. Return whether the texture could be locked.
+ */
+static bool graphics_draw_locked(graphics_t* graphics, const SDL_Rect* rect) {
+    void* pixels = NULL;
+    int32_t pitch;
+    if (SDL_LockTexture(graphics->texture, rect, &pixels, &pitch) < 0) {
+        return false;
+    }
+    uint32_t first_row = rect->y / BLOCK_HEIGHT;
+    uint32_t first_col = rect->x / BLOCK_WIDTH;
+    for (uint32_t r = first_row; r < first_row + rect->h / BLOCK_HEIGHT; ++r) {
+        uint8_t* dest = (uint8_t*)pixels + (r - first_row) * BLOCK_HEIGHT * pitch;
+        for (uint32_t c = first_col; c < first_col + rect->w / BLOCK_WIDTH; ++c) {
+            graphics_tile_copy(graphics, graphics->cells[r][c], dest, pitch);
+            graphics->drawn[r][c] = graphics->cells[r][c];
+            dest += BLOCK_WIDTH * BYTES_PER_PIXEL;
+        }
+    }
+    SDL_UnlockTexture(graphics->texture);
+    return true;
+}
+
+/*
+ * Draw the cells that changed into the staging pixels, then copy a rectangle of them into the
+ * texture. Return whether the texture could be updated.
+ */
+static bool graphics_draw_staged(graphics_t* graphics, const SDL_Rect* rect) {
+    int32_t pitch = graphics->cols * BLOCK_WIDTH * BYTES_PER_PIXEL;
+    for (uint32_t r = 0; r < graphics->rows; ++r) {
+        for (uint32_t c = 0; c < graphics->cols; ++c) {
+            uint8_t tile = graphics->cells[r][c];
+            if (tile == graphics->drawn[r][c]) {
+                continue;
+            }
+            uint8_t* dest = graphics->pixels + r * BLOCK_HEIGHT * pitch
+                            + c * BLOCK_WIDTH * BYTES_PER_PIXEL;
+            graphics_tile_copy(graphics, tile, dest, pitch);
+            graphics->drawn[r][c] = tile;
+        }
+    }
+    const uint8_t* src = graphics->pixels + rect->y * pitch + rect->x * BYTES_PER_PIXEL;
+    return SDL_UpdateTexture(graphics->texture, rect, src, pitch) == 0;
+}
+
+/*
+ * Bring the texture up to date with the cells, touching only the smallest rectangle that holds
+ * every cell that changed. Nothing is uploaded when no cell changed.
+ *
+ * The cells are drawn straight into the locked texture, which saves a copy of every changed
+ * pixel and a buffer the size of the texture. If the texture can not be locked, the cells are
+ * drawn into a staging buffer of our own and copied into the texture with SDL_UpdateTexture
+ * from then on.
+ */
+static void graphics_update_texture(graphics_t* graphics) {
+    graphics_update_tiles(graphics);
+    graphics->upload_bytes = 0;
+    SDL_Rect rect;
+    if (!graphics_dirty_rect(graphics, &rect)) {
+        return;
+    }
+    if (!graphics->pixels) {
+        if (graphics_draw_locked(graphics, &rect)) {
+            graphics->upload_bytes = rect.w * rect.h * BYTES_PER_PIXEL;
+            graphics->upload_total += graphics->upload_bytes;
+            return;
+        }
+        graphics->pixels = malloc(graphics->size);
+        if (!graphics->pixels) {
+            return;
+        }
+        /* the staging buffer starts out empty */
+        memset(graphics->drawn, TILE_UNDRAWN, sizeof(graphics->drawn));
+        graphics_dirty_rect(graphics, &rect);
+    }
+    if (!graphics_draw_staged(graphics, &rect)) {
+        /* the texture still shows the old cells, so draw them all again next time */
+        memset(graphics->drawn, TILE_UNDRAWN, sizeof(graphics->drawn));
+        return;
+    }
+    graphics->upload_bytes = rect.w * rect.h * BYTES_PER_PIXEL;
+    graphics->upload_total += graphics->upload_bytes;
+}
+
+/*
+ * Return whether graphics_render would show anything new, that is whether a cell or the pallete
+ * changed since the last render.
+ */
+bool graphics_changed(const graphics_t* graphics) {
+    if (graphics->tiles_pallete != graphics->pallete_value % NUM_PALLETES) {
+        return true;
+    }
+    for (uint32_t r = 0; r < graphics->rows; ++r) {
+        if (memcmp(graphics->cells[r], graphics->drawn[r], graphics->cols) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /* Scale the game to fill as much of the screen as possible without distortion. */
 void graphics_render(SDL_Renderer* renderer, graphics_t* graphics) {
     int32_t screen_width;
@@ -412,11 +498,7 @@ void graphics_render(SDL_Renderer* renderer, graphics_t* graphics) {
     rect.w = render_width;
     rect.h = render_height;
 
-    void* pixels = NULL;
-    int32_t pitch;
-    SDL_LockTexture(graphics->texture, NULL, &pixels, &pitch);
-    memcpy(pixels, graphics->pixels, pitch * texture_height);
-    SDL_UnlockTexture(graphics->texture);
+    graphics_update_texture(graphics);
     SDL_RenderCopy(renderer, graphics->texture, NULL, &rect);
     SDL_RenderPresent(renderer);
 }
@@ -445,11 +527,7 @@ void graphics_render_stretch(SDL_Renderer* renderer, graphics_t* graphics) {
         rect.h = render_height;
     }
 
-    void* pixels = NULL;
-    int32_t pitch;
-    SDL_LockTexture(graphics->texture, NULL, &pixels, &pitch);
-    memcpy(pixels, graphics->pixels, pitch * texture_height);
-    SDL_UnlockTexture(graphics->texture);
+    graphics_update_texture(graphics);
     SDL_RenderCopy(renderer, graphics->texture, NULL, &rect);
     SDL_RenderPresent(renderer);
 }
@@ -33,11 +33,44 @@ enum {
     REND_GRAY = 0x17,
 };
 
+enum {
+    BLOCK_WIDTH = 8,
+    BLOCK_HEIGHT = 8,
+};
+
+/*
+ * The three styles of blocks (see type_to_nes_type), the curtain, and the two backgrounds. Each
+ * cell of the texture shows one of them.
+ */
+enum {
+    TILE_BLOCK1,
+    TILE_BLOCK2,
+    TILE_BLOCK3,
+    TILE_CURTAIN,
+    TILE_GRAY,
+    TILE_CLEAR,
+    NUM_TILES,
+    TILE_UNDRAWN = 0xFF, /* a cell whose pixels are not known */
+};
+
 typedef struct {
     SDL_Texture* texture;
-    uint8_t* pixels;
-    uint32_t size;
+    uint8_t* pixels; /* staging buffer, NULL while the cells are drawn straight into the texture */
+    uint32_t size; /* bytes in the staging buffer */
     uint32_t pallete_value;
+    uint32_t tiles[NUM_TILES][BLOCK_HEIGHT][BLOCK_WIDTH]; /* RGBA8888 pixels in the current pallete */
+    uint32_t tiles_pallete; /* the pallete the tiles were made with, UINT32_MAX for none */
+    /*
+     * The drawing functions only set the tile of each cell in `cells`. graphics_render then
+     * draws the cells that differ from `drawn` into the smallest rectangle of the texture around
+     * them.
+     */
+    uint8_t cells[MATRIX_MAX_ROWS][MATRIX_MAX_COLS]; /* cells[row - hidden rows][col] */
+    uint8_t drawn[MATRIX_MAX_ROWS][MATRIX_MAX_COLS]; /* what the texture shows of each cell */
+    uint32_t rows; /* visible rows */
+    uint32_t cols;
+    uint32_t upload_bytes; /* bytes uploaded to the texture by the last graphics_render */
+    uint64_t upload_total; /* bytes uploaded since the graphics were made */
 } graphics_t;
 
 uint32_t rand_pallete_value();
@@ -54,6 +87,7 @@ void        graphics_anim_clear(graphics_t* graphics, const matrix_t* matrix, ui
 void        graphics_curtain1(graphics_t* graphics, const matrix_t* matrix, uint64_t time, uint64_t duration);
 void        graphics_curtain2(graphics_t* graphics, const matrix_t* matrix);
 void        graphics_curtain3(graphics_t* graphics, const matrix_t* matrix, uint64_t time, uint64_t duration);
+bool        graphics_changed(const graphics_t* graphics);
 void        graphics_render(SDL_Renderer* renderer, graphics_t* graphics);
 void        graphics_free(graphics_t* graphics);
 
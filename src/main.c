@@ -23,13 +23,25 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 #include "SDL.h"
 #include "matrix.h"
 #include "graphics.h"
 #include "bot.h"
+#include "planner.h"
+#include "surface.h"
+#include "bench.h"
 #include "errorvalues.h"
 
+/*
+ * Extra threads that try piece types at once, see bot_set_threads. The pool is off unless the
+ * program is built with `make BOT_THREADS=N`, since /b has only shown it to be slower so far.
+ */
+#ifndef BOT_THREADS
+#define BOT_THREADS 0
+#endif
+
 enum {
     SCREEN_DEFAULT_WIDTH = 1280,
     SCREEN_DEFAULT_HEIGHT = 720,
@@ -59,6 +71,16 @@ enum {
     BOT_DELAY_AFTER_ROTATION = 200,
 };
 
+/* The bot works a little every frame, see main_loop. */
+enum {
+    BOT_SEARCH_DEPTH = 6,
+    BOT_SEARCH_BEAM = 8,
+    BOT_FRAME_PERCENT = 50, /* share of each frame the bot may use */
+    BOT_PLANNER_BUDGET_US = 100000, /* time the planner thread may spend on a piece */
+    FRAME_DEFAULT_RATE = 60,
+    FRAME_SAMPLES = 600, /* frames between reports of frame times in debug mode */
+};
+
 /*
  * Initiate the SDL library, set up the game, and call srand. Return 0 on success or a non-zero
  * value on error.
@@ -125,41 +147,181 @@ bool event_quit(uint32_t type, bool ignore_mouse_motion, bool debug_mode) {
     return quit;
 }
 
-void are_loop(SDL_Renderer* renderer, graphics_t* graphics, const matrix_t* matrix,
-              piece_t** piece, SDL_Event* event, bool* quit, bool debug_mode) {
+/*
+ * Handle every pending event. A window event (the window was shown, moved or resized) makes the
+ * next frame be presented even if nothing in it changed. Return whether any user input has been
+ * made, see event_quit.
+ */
+bool events_poll(SDL_Event* event, bool ignore_mouse_motion, bool debug_mode, bool* redraw) {
+    bool quit = false;
+    while (SDL_PollEvent(event) != 0) {
+        quit = quit || event_quit(event->type, ignore_mouse_motion, debug_mode);
+        if (event->type == SDL_WINDOWEVENT) {
+            *redraw = true;
+        }
+    }
+    return quit;
+}
+
+/*
+ * Return the tick at which an animation that started at tick `start` and moves `steps` times,
+ * evenly over `duration` ticks, moves next after tick `now`.
+ */
+uint64_t anim_next_step(uint64_t start, uint64_t now, uint64_t duration, uint32_t steps) {
+    uint64_t step = (now - start) * steps / duration + 1;
+    return start + (step * duration + steps - 1) / steps;
+}
+
+/* Timing of the frame being drawn, see frame_work and frame_present. */
+typedef struct {
+    uint64_t start; /* when the previous frame was presented */
+    uint64_t length; /* ticks between frames */
+    uint64_t bot_ticks; /* ticks of each frame the bot may work */
+    bool debug_mode;
+    uint32_t num_samples;
+    uint32_t work_us[FRAME_SAMPLES]; /* time each frame took before it was presented */
+    uint64_t upload_bytes; /* bytes uploaded to the texture during the samples */
+    bool redraw; /* present the next frame even if the texture did not change */
+} frame_t;
+
+/*
+ * Set up the frame timing. The length of a frame comes from the refresh rate of the display the
+ * window is on, since the renderer waits for vsync.
+ */
+void frame_init(frame_t* frame, SDL_Renderer* renderer, bool debug_mode) {
+    int32_t refresh_rate = FRAME_DEFAULT_RATE;
+    SDL_Window* window = SDL_RenderGetWindow(renderer);
+    SDL_DisplayMode mode;
+    if (window && SDL_GetWindowDisplayMode(window, &mode) == 0 && mode.refresh_rate > 0) {
+        refresh_rate = mode.refresh_rate;
+    }
+    frame->start = SDL_GetPerformanceCounter();
+    frame->length = SDL_GetPerformanceFrequency() / refresh_rate;
+    frame->bot_ticks = frame->length * BOT_FRAME_PERCENT / 100;
+    frame->debug_mode = debug_mode;
+    frame->num_samples = 0;
+    frame->upload_bytes = 0;
+    frame->redraw = true;
+}
+
+/*
+ * Let the bot work until its share of the current frame is used up. `bot` may be NULL. Return 0
+ * on success or a non-zero value on failure.
+ */
+int32_t frame_work(frame_t* frame, bot_t* bot) {
+    uint64_t now = SDL_GetPerformanceCounter();
+    uint64_t deadline = frame->start + frame->bot_ticks;
+    if (!bot || bot_done(bot) || now >= deadline) {
+        return 0;
+    }
+    return bot_step(bot, (deadline - now) * 1000000000 / SDL_GetPerformanceFrequency());
+}
+
+/* Return whether frame_work has anything to do for `bot`, which may be NULL. */
+bool frame_has_work(const bot_t* bot) {
+    return bot && !bot_done(bot);
+}
+
+static int compare_uint32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Present the frame if anything on screen changed, then wait for an event until tick `wake` (of
+ * SDL_GetTicks64), when something on screen is due to change. If `every_frame` is set, the wait
+ * ends with the frame instead, for work that is done a little each frame such as frame_work.
+ * This keeps the program idle between changes even without vsync.
+ *
+ * In debug mode, the time spent on each frame before presenting it is recorded, and the 99th
+ * percentile and the longest time are printed every FRAME_SAMPLES frames along with the length
+ * of a frame and the mean number of bytes uploaded to the texture.
+ */
+void frame_present(frame_t* frame, SDL_Renderer* renderer, graphics_t* graphics,
+                   uint64_t wake, bool every_frame) {
+    uint64_t frequency = SDL_GetPerformanceFrequency();
+    if (frame->debug_mode) {
+        uint64_t work = SDL_GetPerformanceCounter() - frame->start;
+        frame->work_us[frame->num_samples++] = work * 1000000 / frequency;
+    }
+    bool present = frame->redraw || graphics_changed(graphics);
+    if (present) {
+        SDL_RenderClear(renderer);
+        graphics_render(renderer, graphics);
+        frame->redraw = false;
+    }
+    if (frame->debug_mode) {
+        frame->upload_bytes += present ? graphics->upload_bytes : 0;
+        if (frame->num_samples == FRAME_SAMPLES) {
+            qsort(frame->work_us, FRAME_SAMPLES, sizeof(uint32_t), compare_uint32);
+            printf("frame time p99: %u us, max: %u us, budget: %u us, upload: %u bytes per frame\n",
+                   (unsigned)frame->work_us[FRAME_SAMPLES * 99 / 100],
+                   (unsigned)frame->work_us[FRAME_SAMPLES - 1],
+                   (unsigned)(frame->length * 1000000 / frequency),
+                   (unsigned)(frame->upload_bytes / FRAME_SAMPLES));
+            frame->num_samples = 0;
+            frame->upload_bytes = 0;
+        }
+    }
+
+    uint64_t now = SDL_GetTicks64();
+    uint64_t timeout = wake > now ? wake - now : 0;
+    if (every_frame) {
+        uint64_t end = frame->start + frame->length;
+        uint64_t counter = SDL_GetPerformanceCounter();
+        uint64_t frame_left = end > counter ? (end - counter) * 1000 / frequency : 0;
+        timeout = frame_left < timeout ? frame_left : timeout;
+    }
+    if (timeout > 0) {
+        /* the event is left in the queue for events_poll */
+        SDL_WaitEventTimeout(NULL, timeout < INT32_MAX ? timeout : INT32_MAX);
+    }
+    frame->start = SDL_GetPerformanceCounter();
+}
+
+int32_t are_loop(SDL_Renderer* renderer, graphics_t* graphics, const matrix_t* matrix,
+                 piece_t* piece, SDL_Event* event, bool* quit, bool debug_mode,
+                 frame_t* frame, bot_t* bot) {
     uint64_t time_end = SDL_GetTicks64() + TIME_ARE;
     while (!(*quit) && time_end > SDL_GetTicks64()) {
-        while (SDL_PollEvent(event) != 0) {
-            *quit = *quit || event_quit(event->type, 0, debug_mode);
+        *quit = events_poll(event, false, debug_mode, &frame->redraw) || *quit;
+        int32_t err_value = frame_work(frame, bot);
+        if (err_value != 0) {
+            return err_value;
         }
-        SDL_RenderClear(renderer);
         graphics_clear_gray(graphics, matrix);
         graphics_matrix(graphics, matrix);
-        graphics_piece(graphics, *piece, matrix);
-        graphics_render(renderer, graphics);
+        graphics_piece(graphics, piece, matrix);
+        frame_present(frame, renderer, graphics, time_end, frame_has_work(bot));
     }
+    return 0;
 }
 
 /* This animation loop is meant to be played when 1-3 lines are cleared. */
-void clear_loop1(SDL_Renderer* renderer, graphics_t* graphics,
-                 const matrix_t* matrix, SDL_Event* event, bool* quit, bool debug_mode) {
+int32_t clear_loop1(SDL_Renderer* renderer, graphics_t* graphics, const matrix_t* matrix,
+                    SDL_Event* event, bool* quit, bool debug_mode, frame_t* frame, bot_t* bot) {
     uint64_t time_start = SDL_GetTicks64();
     uint64_t time_end = SDL_GetTicks64() + TIME_CLEAR;
     while (!(*quit) && time_end > SDL_GetTicks64()) {
-        while (SDL_PollEvent(event) != 0) {
-            *quit = *quit || event_quit(event->type, 0, debug_mode);
+        *quit = events_poll(event, false, debug_mode, &frame->redraw) || *quit;
+        int32_t err_value = frame_work(frame, bot);
+        if (err_value != 0) {
+            return err_value;
         }
-        uint64_t time_from_start = SDL_GetTicks64() - time_start;
-        SDL_RenderClear(renderer);
+        uint64_t now = SDL_GetTicks64();
         graphics_clear_gray(graphics, matrix);
-        graphics_anim_clear(graphics, matrix, time_from_start, TIME_CLEAR);
-        graphics_render(renderer, graphics);
+        graphics_anim_clear(graphics, matrix, now - time_start, TIME_CLEAR);
+        uint64_t wake = anim_next_step(time_start, now, TIME_CLEAR, matrix->cols / 2);
+        frame_present(frame, renderer, graphics, wake < time_end ? wake : time_end,
+                      frame_has_work(bot));
     }
+    return 0;
 }
 
 /* This animation loop is meant to be played when 4 lines are cleared. */
-void clear_loop2(SDL_Renderer* renderer, graphics_t* graphics,
-                 const matrix_t* matrix, SDL_Event* event, bool* quit, bool debug_mode) {
+int32_t clear_loop2(SDL_Renderer* renderer, graphics_t* graphics, const matrix_t* matrix,
+                    SDL_Event* event, bool* quit, bool debug_mode, frame_t* frame, bot_t* bot) {
     uint64_t time_start = SDL_GetTicks64();
     uint64_t time_end = SDL_GetTicks64() + TIME_CLEAR;
     uint32_t interval = TIME_CLEAR / FLASH_STATES;
@@ -170,11 +332,15 @@ void clear_loop2(SDL_Renderer* renderer, graphics_t* graphics,
 
     uint32_t index_flash = 0;
     bool state_flash = false;
+    int32_t err_value = 0;
     while (!(*quit) && time_end > SDL_GetTicks64()) {
-        while (SDL_PollEvent(event) != 0) {
-            *quit = *quit || event_quit(event->type, 0, debug_mode);
+        *quit = events_poll(event, false, debug_mode, &frame->redraw) || *quit;
+        err_value = frame_work(frame, bot);
+        if (err_value != 0) {
+            break;
         }
-        uint64_t time_from_start = SDL_GetTicks64() - time_start;
+        uint64_t now = SDL_GetTicks64();
+        uint64_t time_from_start = now - time_start;
         if (index_flash < FLASH_STATES && time_from_start > time_flash_states[index_flash]) {
             state_flash = !state_flash;
             if (state_flash) {
@@ -182,81 +348,143 @@ void clear_loop2(SDL_Renderer* renderer, graphics_t* graphics,
             } else {
                 SDL_SetRenderDrawColor(renderer, REND_GRAY, REND_GRAY, REND_GRAY, 0xFF);
             }
+            /* the background changed, not the texture */
+            frame->redraw = true;
             ++index_flash;
         }
 
-        SDL_RenderClear(renderer);
         graphics_clear(graphics, matrix);
         graphics_anim_clear(graphics, matrix, time_from_start, TIME_CLEAR);
-        graphics_render(renderer, graphics);
+        uint64_t wake = anim_next_step(time_start, now, TIME_CLEAR, matrix->cols / 2);
+        if (index_flash < FLASH_STATES && time_start + time_flash_states[index_flash] + 1 < wake) {
+            wake = time_start + time_flash_states[index_flash] + 1;
+        }
+        frame_present(frame, renderer, graphics, wake < time_end ? wake : time_end,
+                      frame_has_work(bot));
     }
     SDL_SetRenderDrawColor(renderer, REND_GRAY, REND_GRAY, REND_GRAY, 0xFF);
+    frame->redraw = true;
+    return err_value;
 }
 
 /* Play the falling curtain animation. */
 void reset_loop1(SDL_Renderer* renderer, graphics_t* graphics, const matrix_t* matrix,
-                 piece_t** piece, SDL_Event* event, bool* quit, bool debug_mode) {
+                 piece_t* piece, SDL_Event* event, bool* quit, bool debug_mode, frame_t* frame) {
     uint64_t time_start = SDL_GetTicks64();
     uint64_t time_end = time_start + TIME_RESET0;
     while (!(*quit) && time_end > SDL_GetTicks64()) {
-        while (SDL_PollEvent(event) != 0) {
-            *quit = *quit || event_quit(event->type, 0, debug_mode);
-        }
-        SDL_RenderClear(renderer);
+        *quit = events_poll(event, false, debug_mode, &frame->redraw) || *quit;
         graphics_clear_gray(graphics, matrix);
         graphics_matrix(graphics, matrix);
-        graphics_piece(graphics, *piece, matrix);
-        graphics_render(renderer, graphics);
+        graphics_piece(graphics, piece, matrix);
+        frame_present(frame, renderer, graphics, time_end, false);
     }
 
     time_start = SDL_GetTicks64();
     time_end = time_start + TIME_RESET1;
     while (!(*quit) && time_end > SDL_GetTicks64()) {
-        while (SDL_PollEvent(event) != 0) {
-            *quit = *quit || event_quit(event->type, 0, debug_mode);
-        }
-        uint64_t time_from_start = SDL_GetTicks64() - time_start;
-        SDL_RenderClear(renderer);
+        *quit = events_poll(event, false, debug_mode, &frame->redraw) || *quit;
+        uint64_t now = SDL_GetTicks64();
         graphics_clear_gray(graphics, matrix);
         graphics_matrix(graphics, matrix);
-        graphics_piece(graphics, *piece, matrix);
-        graphics_curtain1(graphics, matrix, time_from_start, TIME_RESET1);
-        graphics_render(renderer, graphics);
+        graphics_piece(graphics, piece, matrix);
+        graphics_curtain1(graphics, matrix, now - time_start, TIME_RESET1);
+        uint64_t wake = anim_next_step(time_start, now, TIME_RESET1,
+                                       matrix->rows - matrix->hidden_rows);
+        frame_present(frame, renderer, graphics, wake < time_end ? wake : time_end, false);
     }
 }
 
 /* Play the rising curtain animation. */
-void reset_loop2(SDL_Renderer* renderer, graphics_t* graphics, const matrix_t* matrix,
-                 piece_t** piece, SDL_Event* event, bool* quit, bool debug_mode) {
+int32_t reset_loop2(SDL_Renderer* renderer, graphics_t* graphics, const matrix_t* matrix,
+                    piece_t* piece, SDL_Event* event, bool* quit, bool debug_mode,
+                    frame_t* frame, bot_t* bot) {
     uint64_t time_start = SDL_GetTicks64();
     uint64_t time_end = time_start + TIME_RESET2;
     while (!(*quit) && time_end > SDL_GetTicks64()) {
-        while (SDL_PollEvent(event) != 0) {
-            *quit = *quit || event_quit(event->type, 0, debug_mode);
+        *quit = events_poll(event, false, debug_mode, &frame->redraw) || *quit;
+        int32_t err_value = frame_work(frame, bot);
+        if (err_value != 0) {
+            return err_value;
         }
-        SDL_RenderClear(renderer);
         graphics_curtain2(graphics, matrix);
-        graphics_render(renderer, graphics);
+        frame_present(frame, renderer, graphics, time_end, frame_has_work(bot));
     }
 
     time_start = SDL_GetTicks64();
     time_end = time_start + TIME_RESET3;
     while (!(*quit) && time_end > SDL_GetTicks64()) {
-        while (SDL_PollEvent(event) != 0) {
-            *quit = *quit || event_quit(event->type, 0, debug_mode);
+        *quit = events_poll(event, false, debug_mode, &frame->redraw) || *quit;
+        int32_t err_value = frame_work(frame, bot);
+        if (err_value != 0) {
+            return err_value;
         }
-        uint64_t time_from_start = SDL_GetTicks64() - time_start;
-        SDL_RenderClear(renderer);
+        uint64_t now = SDL_GetTicks64();
         graphics_clear_gray(graphics, matrix);
-        graphics_piece(graphics, *piece, matrix);
-        graphics_curtain3(graphics, matrix, time_from_start, TIME_RESET3);
-        graphics_render(renderer, graphics);
+        graphics_piece(graphics, piece, matrix);
+        graphics_curtain3(graphics, matrix, now - time_start, TIME_RESET3);
+        uint64_t wake = anim_next_step(time_start, now, TIME_RESET3,
+                                       matrix->rows - matrix->hidden_rows);
+        frame_present(frame, renderer, graphics, wake < time_end ? wake : time_end,
+                      frame_has_work(bot));
     }
+    return 0;
 }
 
+/*
+ * Keep drawing the matrix until the planner hands the bot back. This normally returns at once,
+ * since the planner's budget is shorter than the ARE. Return 0 on success or the error of the
+ * planner's job.
+ */
+int32_t planner_wait_loop(SDL_Renderer* renderer, graphics_t* graphics, const matrix_t* matrix,
+                          SDL_Event* event, bool* quit, bool debug_mode, frame_t* frame,
+                          planner_t* planner) {
+    int32_t err_value = 0;
+    while (!planner_ready(planner, &err_value)) {
+        *quit = events_poll(event, false, debug_mode, &frame->redraw) || *quit;
+        graphics_clear_gray(graphics, matrix);
+        graphics_matrix(graphics, matrix);
+        /* the planner can not wake this thread, so check on it once a frame */
+        frame_present(frame, renderer, graphics, UINT64_MAX, true);
+    }
+    return err_value;
+}
+
+/*
+ * Run the game. The bot starts choosing the next piece as soon as a piece is placed. If there is
+ * more than one CPU, the planner thread does this while the line clear and the ARE play out.
+ * Otherwise the bot works in its share of each of those frames (see frame_work). Either way, it
+ * then searches for the placement of the new piece while the piece waits at spawn.
+ */
 int32_t main_loop(SDL_Renderer* renderer, graphics_t* graphics,
-                  matrix_t* matrix, piece_t** piece, bool debug_mode) {
-    bot_t bot = bot_new();
+                  matrix_t* matrix, piece_t* piece, bool debug_mode) {
+    bot_t* bot = bot_new(matrix);
+    if (!bot) {
+        return ERROR_BOT;
+    }
+    bot->search_depth = BOT_SEARCH_DEPTH;
+    bot->beam_width = BOT_SEARCH_BEAM;
+    /* without the table (see `make surface`) every placement is searched for */
+    uint32_t fingerprint;
+    int32_t tmp_err_value = bot_fingerprint(bot, &fingerprint);
+    if (tmp_err_value != 0) {
+        bot_free(bot);
+        return tmp_err_value;
+    }
+    surface_table_t* surface = surface_open_default(matrix, fingerprint);
+    bot->surface = surface;
+    /*
+     * The pool's threads need a CPU each besides the planner thread and this one. Without the
+     * pool, which is also what a failure leaves, the bot chooses the same pieces.
+     */
+    if (BOT_THREADS > 0 && SDL_GetCPUCount() >= BOT_THREADS + 2) {
+        bot_set_threads(bot, BOT_THREADS);
+    }
+    planner_t* planner = planner_new(bot, BOT_PLANNER_BUDGET_US);
+    /* the bot that the animation loops may step, NULL while the planner has it */
+    bot_t* frame_bot = planner ? NULL : bot;
+    frame_t frame;
+    frame_init(&frame, renderer, debug_mode);
     inputs_t inputs;
     inputs_clear(&inputs);
     SDL_Event event;
@@ -270,25 +498,47 @@ int32_t main_loop(SDL_Renderer* renderer, graphics_t* graphics,
     bool bot_force_drop = false;
     bool quit = false;
 
-    int32_t err_value = 0;
-    *piece = bot_next_piece(&bot, matrix, &err_value);
+    /* the matrix is empty, so the first piece fits right away */
+    int32_t err_value = bot_next_piece(bot, matrix, piece);
     if (err_value != 0) {
+        planner_free(planner);
+        bot_free(bot);
+        surface_close(surface);
         return err_value;
     }
     while (!quit) {
         uint64_t ticks = SDL_GetTicks64();
-        while (SDL_PollEvent(&event) != 0) {
-            /*
-             * SDL_MOUSEMOTION event happens when the application opens while the cursor is inside
-             * window. To prevent the application from immediately closing, this event is ignored
-             * on the first iteration of the main loop.
-             */
-            quit = quit || event_quit(event.type, ignore_mouse_motion, debug_mode);
-        }
+        /*
+         * SDL_MOUSEMOTION event happens when the application opens while the cursor is inside
+         * window. To prevent the application from immediately closing, this event is ignored on
+         * the first iteration of the main loop.
+         */
+        quit = events_poll(&event, ignore_mouse_motion, debug_mode, &frame.redraw) || quit;
         ignore_mouse_motion = false;
 
+        /*
+         * Refine the placement a little each frame while the piece waits at spawn, and commit to
+         * it when the bot starts moving the piece.
+         */
+        bool bot_thinking = bot->searching || bot->search_pending;
+        if (bot_thinking) {
+            if (ticks > delay_bot_until || bot_done(bot)) {
+                err_value = bot_search_finish(bot, matrix);
+                bot_thinking = false;
+            } else {
+                err_value = frame_work(&frame, bot);
+            }
+            if (err_value != 0) {
+                break;
+            }
+        }
+
         bool was_prev_input_move = inputs.left || inputs.right;
-        bot_update_inputs(&bot, &inputs, *piece);
+        if (bot_thinking) {
+            inputs_clear(&inputs);
+        } else {
+            bot_update_inputs(bot, &inputs, piece);
+        }
         /* delay the bot's input before dropping the piece */
         if (was_prev_input_move && inputs.down) {
             delay_bot_until = ticks + BOT_DELAY_AFTER_MOVEMENT;
@@ -300,92 +550,129 @@ int32_t main_loop(SDL_Renderer* renderer, graphics_t* graphics,
                 inputs.down = true;
             }
             if (inputs.ccw) {
-                bot_force_drop = !piece_rotate_ccw(*piece, matrix);
+                bot_force_drop = !piece_rotate_ccw(piece, matrix);
                 delay_bot_until = ticks + BOT_DELAY_AFTER_ROTATION;
             }
             if (inputs.cw) {
-                bot_force_drop = !piece_rotate_cw(*piece, matrix);
+                bot_force_drop = !piece_rotate_cw(piece, matrix);
                 delay_bot_until = ticks + BOT_DELAY_AFTER_ROTATION;
             }
             if (inputs.left) {
                 if (ticks > time_next_das) {
-                    bot_force_drop = !piece_move_left(*piece, matrix);
+                    bot_force_drop = !piece_move_left(piece, matrix);
                     time_next_das = ticks + TIME_ARR;
                 }
             }
             if (inputs.right) {
                 if (ticks > time_next_das) {
-                    bot_force_drop = !piece_move_right(*piece, matrix);
+                    bot_force_drop = !piece_move_right(piece, matrix);
                     time_next_das = ticks + TIME_ARR;
                 }
             }
             if (inputs.down) {
                 if (ticks > time_next_down) {
-                    check_place_piece = !piece_move_down(*piece, matrix);
+                    check_place_piece = !piece_move_down(piece, matrix);
                     time_next_down = ticks + TIME_DROP;
                 }
             }
         }
 
         if (check_place_piece) {
-            piece_place(*piece, matrix);
-            are_loop(renderer, graphics, matrix, piece, &event, &quit, debug_mode);
-            uint32_t filled_rows = 0;
-            bool play_clear = false;
-            for (size_t r = 0; r < matrix->rows; ++r) {
-                if (matrix_row_full(matrix, r)) {
-                    ++filled_rows;
-                    ++lines_cleared;
-                    play_clear = true;
-                }
+            uint32_t filled_rows = piece_place(piece, matrix);
+            err_value = bot_start(bot, matrix);
+            if (err_value == 0 && planner) {
+                planner_post(planner);
+            }
+            if (err_value == 0) {
+                err_value = are_loop(renderer, graphics, matrix, piece, &event, &quit, debug_mode,
+                                     &frame, frame_bot);
             }
-            if (play_clear) {
+            if (err_value == 0 && filled_rows > 0) {
+                lines_cleared += filled_rows;
                 if (filled_rows >= LINES_CLEARED_TETRIS) {
-                    clear_loop2(renderer, graphics, matrix, &event, &quit, debug_mode);
+                    err_value = clear_loop2(renderer, graphics, matrix, &event, &quit, debug_mode,
+                                            &frame, frame_bot);
                 } else {
-                    clear_loop1(renderer, graphics, matrix, &event, &quit, debug_mode);
+                    err_value = clear_loop1(renderer, graphics, matrix, &event, &quit, debug_mode,
+                                            &frame, frame_bot);
                 }
-                matrix_clean(matrix);
+                matrix_clean(matrix, NULL);
                 if (lines_cleared >= lines_next_pallete) {
                     ++graphics->pallete_value;
                     lines_next_pallete += LINES_PER_PALLETE;
                 }
             }
-            piece_free(*piece);
-            *piece = bot_next_piece(&bot, matrix, &err_value);
+            /* the bot must be back from the planner even if there was an error */
+            if (planner) {
+                int32_t planner_err_value = planner_wait_loop(renderer, graphics, matrix, &event,
+                                                              &quit, debug_mode, &frame, planner);
+                err_value = err_value != 0 ? err_value : planner_err_value;
+            }
+            /* the choice is normally made during the ARE, so this rarely has anything to do */
+            if (err_value == 0) {
+                err_value = bot_spawn(bot, matrix, piece);
+            }
             if (err_value != 0) {
-                return err_value;
+                break;
+            }
+            if (debug_mode) {
+                printf("piece features: %u evaluated, %u skipped\n",
+                       (unsigned)bot->scratch.features_evaluated,
+                       (unsigned)bot->scratch.features_skipped);
             }
             /* If spawned piece collides with stack, play game over animation and reset game. */
-            if (piece_collides(*piece, matrix)) {
-                reset_loop1(renderer, graphics, matrix, piece, &event, &quit, debug_mode);
+            if (piece_collides(piece, matrix)) {
+                reset_loop1(renderer, graphics, matrix, piece, &event, &quit, debug_mode, &frame);
                 matrix_clear(matrix);
-                piece_free(*piece);
-                *piece = bot_next_piece(&bot, matrix, &err_value);
+                err_value = bot_next_piece(bot, matrix, piece);
+                if (err_value == 0) {
+                    err_value = reset_loop2(renderer, graphics, matrix, piece, &event, &quit,
+                                            debug_mode, &frame, bot);
+                }
                 if (err_value != 0) {
-                    return err_value;
+                    break;
                 }
-                reset_loop2(renderer, graphics, matrix, piece, &event, &quit, debug_mode);
             }
             bot_force_drop = 0;
             check_place_piece = 0;
             delay_bot_until = SDL_GetTicks64() + BOT_DELAY_AFTER_SPAWN;
         }
 
-        SDL_RenderClear(renderer);
+        /*
+         * Sleep until the piece can move next: when the bot's delay is over, and after that at
+         * the next drop or the next repeat of a move to the side. Rotations happen on the next
+         * frame. A piece that can not drop any further was already placed above.
+         */
+        uint64_t now = SDL_GetTicks64();
+        uint64_t wake = delay_bot_until + 1;
+        bot_thinking = bot->searching || bot->search_pending;
+        if (!bot_thinking && now > delay_bot_until) {
+            inputs_t next_inputs;
+            bot_update_inputs(bot, &next_inputs, piece);
+            if (bot_force_drop || next_inputs.down) {
+                wake = time_next_down + 1;
+            } else if (next_inputs.left || next_inputs.right) {
+                wake = time_next_das + 1;
+            } else {
+                wake = now;
+            }
+        }
         graphics_clear_gray(graphics, matrix);
         graphics_matrix(graphics, matrix);
-        graphics_piece(graphics, *piece, matrix);
-        graphics_render(renderer, graphics);
+        graphics_piece(graphics, piece, matrix);
+        frame_present(&frame, renderer, graphics, wake, bot_thinking && !bot_done(bot));
     }
-    return 0;
+    planner_free(planner);
+    bot_free(bot);
+    surface_close(surface);
+    return err_value;
 }
 
 int32_t main(int32_t argc, char **argv) {
     SDL_Window* window = NULL;
     SDL_Renderer* renderer = NULL;
     matrix_t* matrix = NULL;
-    piece_t* piece = NULL;
+    piece_t piece;
     graphics_t* graphics = NULL;
 
     int32_t err_value = 0;
@@ -399,6 +686,8 @@ int32_t main(int32_t argc, char **argv) {
             init_attempted = true;
             debug = true;
             err_value = init(&window, SDL_WINDOW_RESIZABLE, &renderer, &graphics, &matrix);
+        } else if (strcmp(argv[1], "/b") == 0) {
+            err_value = bench_run();
         } else {
             err_value = ERROR_UNKNOWN_ARGUMENT;
         }
@@ -413,12 +702,10 @@ int32_t main(int32_t argc, char **argv) {
         printf("Error value: %d\n", err_value);
     }
 
-    piece_free(piece);
     matrix_free(matrix);
     graphics_free(graphics);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
-    piece = NULL;
     matrix = NULL;
     graphics = NULL;
     renderer = NULL;
@@ -24,7 +24,9 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
+#include "SDL_stdinc.h"
 #include "matrix.h"
 
 enum {
@@ -51,181 +53,154 @@ enum {
     Z_COLS = 3,
 };
 
-const uint8_t LINE_TABLE[LINE_ORIENTS][LINE_ROWS][LINE_COLS] = {
-    {
-        { TYPE_NONE, TYPE_NONE, TYPE_NONE, TYPE_NONE },
-        { TYPE_NONE, TYPE_NONE, TYPE_NONE, TYPE_NONE },
-        { TYPE_LINE, TYPE_LINE, TYPE_LINE, TYPE_LINE },
-        { TYPE_NONE, TYPE_NONE, TYPE_NONE, TYPE_NONE },
-    },
-    {
-        { TYPE_NONE, TYPE_NONE, TYPE_LINE, TYPE_NONE },
-        { TYPE_NONE, TYPE_NONE, TYPE_LINE, TYPE_NONE },
-        { TYPE_NONE, TYPE_NONE, TYPE_LINE, TYPE_NONE },
-        { TYPE_NONE, TYPE_NONE, TYPE_LINE, TYPE_NONE },
-    },
+/* Build a shape_t from the { row, col } positions of its four blocks. */
+#define SHAPE_ROW_MASK(row, r0, c0, r1, c1, r2, c2, r3, c3) \
+    (((r0) == (row)) << (c0) | ((r1) == (row)) << (c1) \
+        | ((r2) == (row)) << (c2) | ((r3) == (row)) << (c3))
+#define SHAPE_MIN(a, b, c, d) \
+    ((a) < (b) ? ((a) < (c) ? ((a) < (d) ? (a) : (d)) : ((c) < (d) ? (c) : (d))) \
+        : ((b) < (c) ? ((b) < (d) ? (b) : (d)) : ((c) < (d) ? (c) : (d))))
+#define SHAPE_MAX(a, b, c, d) \
+    ((a) > (b) ? ((a) > (c) ? ((a) > (d) ? (a) : (d)) : ((c) > (d) ? (c) : (d))) \
+        : ((b) > (c) ? ((b) > (d) ? (b) : (d)) : ((c) > (d) ? (c) : (d))))
+#define SHAPE_BOTTOM(col, r0, c0, r1, c1, r2, c2, r3, c3) \
+    SHAPE_MAX((c0) == (col) ? (r0) : -1, (c1) == (col) ? (r1) : -1, \
+        (c2) == (col) ? (r2) : -1, (c3) == (col) ? (r3) : -1)
+#define SHAPE(r0, c0, r1, c1, r2, c2, r3, c3) { \
+    .row_masks = { \
+        SHAPE_ROW_MASK(0, r0, c0, r1, c1, r2, c2, r3, c3), \
+        SHAPE_ROW_MASK(1, r0, c0, r1, c1, r2, c2, r3, c3), \
+        SHAPE_ROW_MASK(2, r0, c0, r1, c1, r2, c2, r3, c3), \
+        SHAPE_ROW_MASK(3, r0, c0, r1, c1, r2, c2, r3, c3), \
+    }, \
+    .cells = { { r0, c0 }, { r1, c1 }, { r2, c2 }, { r3, c3 } }, \
+    .bottoms = { \
+        SHAPE_BOTTOM(0, r0, c0, r1, c1, r2, c2, r3, c3), \
+        SHAPE_BOTTOM(1, r0, c0, r1, c1, r2, c2, r3, c3), \
+        SHAPE_BOTTOM(2, r0, c0, r1, c1, r2, c2, r3, c3), \
+        SHAPE_BOTTOM(3, r0, c0, r1, c1, r2, c2, r3, c3), \
+    }, \
+    .min_x = SHAPE_MIN(c0, c1, c2, c3), \
+    .max_x = SHAPE_MAX(c0, c1, c2, c3), \
+    .min_y = SHAPE_MIN(r0, r1, r2, r3), \
+    .max_y = SHAPE_MAX(r0, r1, r2, r3), \
+}
+
+const shape_t LINE_SHAPES[LINE_ORIENTS] = {
+    SHAPE(2, 0, 2, 1, 2, 2, 2, 3), /* ....|....|####|.... */
+    SHAPE(0, 2, 1, 2, 2, 2, 3, 2), /* ..#.|..#.|..#.|..#. */
+};
+
+const shape_t O_SHAPES[O_ORIENTS] = {
+    SHAPE(1, 1, 1, 2, 2, 1, 2, 2), /* ....|.##.|.##.|.... */
 };
 
-const uint8_t O_TABLE[O_ORIENTS][O_ROWS][O_COLS] = {
-    {
-        { TYPE_NONE, TYPE_NONE, TYPE_NONE, TYPE_NONE },
-        { TYPE_NONE, TYPE_O, TYPE_O, TYPE_NONE },
-        { TYPE_NONE, TYPE_O, TYPE_O, TYPE_NONE },
-        { TYPE_NONE, TYPE_NONE, TYPE_NONE, TYPE_NONE },
-    },
+const shape_t J_SHAPES[J_ORIENTS] = {
+    SHAPE(1, 0, 1, 1, 1, 2, 2, 2), /* ...|###|..# */
+    SHAPE(0, 1, 1, 1, 2, 0, 2, 1), /* .#.|.#.|##. */
+    SHAPE(0, 0, 1, 0, 1, 1, 1, 2), /* #..|###|... */
+    SHAPE(0, 1, 0, 2, 1, 1, 2, 1), /* .##|.#.|.#. */
 };
 
-const uint8_t J_TABLE[J_ORIENTS][J_ROWS][J_COLS] = {
-    {
-        { TYPE_NONE, TYPE_NONE, TYPE_NONE },
-        { TYPE_J, TYPE_J, TYPE_J },
-        { TYPE_NONE, TYPE_NONE, TYPE_J },
-    },
-    {
-        { TYPE_NONE, TYPE_J, TYPE_NONE },
-        { TYPE_NONE, TYPE_J, TYPE_NONE },
-        { TYPE_J, TYPE_J, TYPE_NONE },
-    },
-    {
-        { TYPE_J, TYPE_NONE, TYPE_NONE },
-        { TYPE_J, TYPE_J, TYPE_J },
-        { TYPE_NONE, TYPE_NONE, TYPE_NONE },
-    },
-    {
-        { TYPE_NONE, TYPE_J, TYPE_J },
-        { TYPE_NONE, TYPE_J, TYPE_NONE },
-        { TYPE_NONE, TYPE_J, TYPE_NONE },
-    },
+const shape_t L_SHAPES[L_ORIENTS] = {
+    SHAPE(1, 0, 1, 1, 1, 2, 2, 0), /* ...|###|#.. */
+    SHAPE(0, 0, 0, 1, 1, 1, 2, 1), /* ##.|.#.|.#. */
+    SHAPE(0, 2, 1, 0, 1, 1, 1, 2), /* ..#|###|... */
+    SHAPE(0, 1, 1, 1, 2, 1, 2, 2), /* .#.|.#.|.## */
 };
 
-const uint8_t L_TABLE[L_ORIENTS][L_ROWS][L_COLS] = {
-    {
-        { TYPE_NONE, TYPE_NONE, TYPE_NONE },
-        { TYPE_L, TYPE_L, TYPE_L },
-        { TYPE_L, TYPE_NONE, TYPE_NONE },
-    },
-    {
-        { TYPE_L, TYPE_L, TYPE_NONE },
-        { TYPE_NONE, TYPE_L, TYPE_NONE },
-        { TYPE_NONE, TYPE_L, TYPE_NONE },
-    },
-    {
-        { TYPE_NONE, TYPE_NONE, TYPE_L },
-        { TYPE_L, TYPE_L, TYPE_L },
-        { TYPE_NONE, TYPE_NONE, TYPE_NONE },
-    },
-    {
-        { TYPE_NONE, TYPE_L, TYPE_NONE },
-        { TYPE_NONE, TYPE_L, TYPE_NONE },
-        { TYPE_NONE, TYPE_L, TYPE_L },
-    },
+const shape_t S_SHAPES[S_ORIENTS] = {
+    SHAPE(1, 1, 1, 2, 2, 0, 2, 1), /* ...|.##|##. */
+    SHAPE(0, 1, 1, 1, 1, 2, 2, 2), /* .#.|.##|..# */
 };
 
-const uint8_t S_TABLE[S_ORIENTS][S_ROWS][S_COLS] = {
-    {
-        { TYPE_NONE, TYPE_NONE, TYPE_NONE },
-        { TYPE_NONE, TYPE_S, TYPE_S },
-        { TYPE_S, TYPE_S, TYPE_NONE },
-    },
-    {
-        { TYPE_NONE, TYPE_S, TYPE_NONE },
-        { TYPE_NONE, TYPE_S, TYPE_S },
-        { TYPE_NONE, TYPE_NONE, TYPE_S },
-    },
+const shape_t T_SHAPES[T_ORIENTS] = {
+    SHAPE(1, 0, 1, 1, 1, 2, 2, 1), /* ...|###|.#. */
+    SHAPE(0, 1, 1, 0, 1, 1, 2, 1), /* .#.|##.|.#. */
+    SHAPE(0, 1, 1, 0, 1, 1, 1, 2), /* .#.|###|... */
+    SHAPE(0, 1, 1, 1, 1, 2, 2, 1), /* .#.|.##|.#. */
 };
 
-const uint8_t T_TABLE[T_ORIENTS][T_ROWS][T_COLS] = {
-    {
-        { TYPE_NONE, TYPE_NONE, TYPE_NONE },
-        { TYPE_T, TYPE_T, TYPE_T },
-        { TYPE_NONE, TYPE_T, TYPE_NONE },
-    },
-    {
-        { TYPE_NONE, TYPE_T, TYPE_NONE },
-        { TYPE_T, TYPE_T, TYPE_NONE },
-        { TYPE_NONE, TYPE_T, TYPE_NONE },
-    },
-    {
-        { TYPE_NONE, TYPE_T, TYPE_NONE },
-        { TYPE_T, TYPE_T, TYPE_T },
-        { TYPE_NONE, TYPE_NONE, TYPE_NONE },
-    },
-    {
-        { TYPE_NONE, TYPE_T, TYPE_NONE },
-        { TYPE_NONE, TYPE_T, TYPE_T },
-        { TYPE_NONE, TYPE_T, TYPE_NONE },
-    },
+const shape_t Z_SHAPES[Z_ORIENTS] = {
+    SHAPE(1, 0, 1, 1, 2, 1, 2, 2), /* ...|##.|.## */
+    SHAPE(0, 2, 1, 1, 1, 2, 2, 1), /* ..#|.##|.#. */
 };
 
-const uint8_t Z_TABLE[Z_ORIENTS][Z_ROWS][Z_COLS] = {
-    {
-        { TYPE_NONE, TYPE_NONE, TYPE_NONE },
-        { TYPE_Z, TYPE_Z, TYPE_NONE },
-        { TYPE_NONE, TYPE_Z, TYPE_Z },
-    },
-    {
-        { TYPE_NONE, TYPE_NONE, TYPE_Z },
-        { TYPE_NONE, TYPE_Z, TYPE_Z },
-        { TYPE_NONE, TYPE_Z, TYPE_NONE },
-    },
+/* MATRIX_DEBRUIJN[(bit * 0x077CB531) >> 27] is the index of `bit`, see MATRIX_LOWEST_BIT */
+const uint8_t MATRIX_DEBRUIJN[32] = {
+    0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+    31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9,
 };
 
+/* Create a new piece at its spawn position. Return NULL on failure. */
 piece_t* piece_new(const matrix_t* matrix, uint8_t type) {
-    piece_t* piece = malloc(sizeof(piece_t));
+    piece_t* piece = SDL_malloc(sizeof(piece_t));
     if (!piece) {
         return NULL;
     }
+    if (!piece_init(piece, matrix, type)) {
+        SDL_free(piece);
+        return NULL;
+    }
+    return piece;
+}
+
+/*
+ * Set up a piece in memory owned by the caller and put it at its spawn position. Return whether
+ * `type` is a valid piece type.
+ */
+bool piece_init(piece_t* piece, const matrix_t* matrix, uint8_t type) {
     switch (type) {
         case TYPE_LINE:
-            piece->table = LINE_TABLE;
+            piece->shapes = LINE_SHAPES;
             piece->orientations = LINE_ORIENTS;
             piece->rows = LINE_ROWS;
             piece->cols = LINE_COLS;
             break;
         case TYPE_O:
-            piece->table = O_TABLE;
+            piece->shapes = O_SHAPES;
             piece->orientations = O_ORIENTS;
             piece->rows = O_ROWS;
             piece->cols = O_COLS;
             break;
         case TYPE_J:
-            piece->table = J_TABLE;
+            piece->shapes = J_SHAPES;
             piece->orientations = J_ORIENTS;
             piece->rows = J_ROWS;
             piece->cols = J_COLS;
             break;
         case TYPE_L:
-            piece->table = L_TABLE;
+            piece->shapes = L_SHAPES;
             piece->orientations = L_ORIENTS;
             piece->rows = L_ROWS;
             piece->cols = L_COLS;
             break;
         case TYPE_S:
-            piece->table = S_TABLE;
+            piece->shapes = S_SHAPES;
             piece->orientations = S_ORIENTS;
             piece->rows = S_ROWS;
             piece->cols = S_COLS;
             break;
         case TYPE_T:
-            piece->table = T_TABLE;
+            piece->shapes = T_SHAPES;
             piece->orientations = T_ORIENTS;
             piece->rows = T_ROWS;
             piece->cols = T_COLS;
             break;
         case TYPE_Z:
-            piece->table = Z_TABLE;
+            piece->shapes = Z_SHAPES;
             piece->orientations = Z_ORIENTS;
             piece->rows = Z_ROWS;
             piece->cols = Z_COLS;
             break;
         default:
-            return NULL;
+            return false;
     }
     piece->orient_index = 0;
     piece->x = matrix->cols / 2 - piece->cols / 2;
     piece->y = matrix->hidden_rows - 1;
     piece->type = type;
-    return piece;
+    return true;
 }
 
 /*
@@ -236,22 +211,53 @@ piece_t* piece_new_rand(const matrix_t* matrix) {
     return piece_new(matrix, rand() % NUM_PIECES + 1);
 }
 
+const shape_t* piece_shape(const piece_t* piece) {
+    return &piece->shapes[piece->orient_index];
+}
+
+/* Return the empty row of a matrix, which only has its wall bits set. */
+static uint32_t matrix_empty_row(const matrix_t* matrix) {
+    return ~(((1u << matrix->cols) - 1) << MATRIX_WALL_BITS);
+}
+
+/*
+ * Return the Zobrist key of a cell: a random-looking 64-bit number made from the position of the
+ * cell with the SplitMix64 finalizer, so that no table of keys needs to be set up.
+ */
+static uint64_t zobrist_key(uint32_t row, uint32_t col) {
+    uint64_t key = ((uint64_t)row * MATRIX_STRIDE + col + 1) * 0x9E3779B97F4A7C15u;
+    key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9u;
+    key = (key ^ (key >> 27)) * 0x94D049BB133111EBu;
+    return key ^ (key >> 31);
+}
+
+/* Return the keys of the filled cells of a row with bits `row_bits` if it were row `row`. */
+static uint64_t zobrist_row(const matrix_t* matrix, uint32_t row, uint32_t row_bits) {
+    uint64_t hash = 0;
+    uint32_t cells = (row_bits >> MATRIX_WALL_BITS) & ((1u << matrix->cols) - 1);
+    for (uint32_t c = 0; cells != 0; ++c, cells >>= 1) {
+        if (cells & 1) {
+            hash ^= zobrist_key(row, c);
+        }
+    }
+    return hash;
+}
+
 /* Return whether the piece either collides with the stack or is out of bounds of the matrix. */
 bool piece_collides(const piece_t* piece, const matrix_t* matrix) {
-    const uint8_t (*table)[piece->orientations][piece->rows][piece->cols] = (const uint8_t(*)[piece->orientations][piece->rows][piece->cols])piece->table;
-    for (int32_t r = 0; r < (int64_t)piece->rows; ++r) {
-        for (int32_t c = 0; c < (int64_t)piece->cols; ++c) {
-            if ((*table)[piece->orient_index][r][c] != TYPE_NONE) {
-                /* check collision with the playfield */
-                if (matrix_out_bounds(matrix, piece->y + r, piece->x + c)) {
-                    return true;
-                } else {
-                    /* check collision with the stack (if there is one) */
-                    if (matrix->table[piece->y + r][piece->x + c] != TYPE_NONE) {
-                        return true;
-                    }
-                }
-            }
+    /* every cell of the piece is past a wall */
+    if (piece->x < -MATRIX_WALL_BITS || piece->x >= (int64_t)matrix->cols) {
+        return true;
+    }
+    const shape_t* shape = piece_shape(piece);
+    uint32_t shift = piece->x + MATRIX_WALL_BITS;
+    for (uint32_t r = shape->min_y; r <= shape->max_y; ++r) {
+        int64_t row = (int64_t)piece->y + r;
+        if (row < 0 || row >= (int64_t)(matrix->rows + MATRIX_FLOOR_ROWS)) {
+            return true;
+        }
+        if (matrix->bits[row] & ((uint32_t)shape->row_masks[r] << shift)) {
+            return true;
         }
     }
     return false;
@@ -267,6 +273,49 @@ bool piece_move_down(piece_t* piece, const matrix_t* matrix) {
     return !collides;
 }
 
+/*
+ * Return how many rows the piece can move down before it lands. The piece should not collide
+ * with the stack. When the piece is above the top of every column it covers, the distance comes
+ * straight from the column heights and the bottom of each column of the piece. Otherwise (the
+ * piece is under an overhang), the piece is moved down one row at a time.
+ */
+uint32_t piece_drop_distance(const piece_t* piece, const matrix_t* matrix) {
+    const shape_t* shape = piece_shape(piece);
+    int32_t distance = INT32_MAX;
+    for (uint32_t c = shape->min_x; c <= shape->max_x; ++c) {
+        int32_t col = piece->x + c;
+        int32_t bottom = piece->y + shape->bottoms[c];
+        if (col < 0 || col >= (int64_t)matrix->cols) {
+            distance = -1;
+            break;
+        }
+        int32_t top = matrix->rows - matrix->heights[col];
+        if (bottom >= top) {
+            distance = -1;
+            break;
+        }
+        if (top - 1 - bottom < distance) {
+            distance = top - 1 - bottom;
+        }
+    }
+    if (distance >= 0) {
+        return distance;
+    }
+    piece_t moved = *piece;
+    uint32_t rows = 0;
+    for (++moved.y; !piece_collides(&moved, matrix); ++moved.y) {
+        ++rows;
+    }
+    return rows;
+}
+
+/* Move the piece down until it lands. Return the number of rows the piece was moved. */
+uint32_t piece_hard_drop(piece_t* piece, const matrix_t* matrix) {
+    uint32_t distance = piece_drop_distance(piece, matrix);
+    piece->y += distance;
+    return distance;
+}
+
 /* Move the piece to the left by one unit. Return whether the piece was able to be moved. */
 bool piece_move_left(piece_t* piece, const matrix_t* matrix) {
     --piece->x;
@@ -327,72 +376,118 @@ bool piece_rotate_cw(piece_t* piece, const matrix_t* matrix) {
     return !collides;
 }
 
-void piece_place(const piece_t* piece, matrix_t* matrix) {
-    const uint8_t (*table)[piece->orientations][piece->rows][piece->cols] = (const uint8_t(*)[piece->orientations][piece->rows][piece->cols])piece->table;
-    for (size_t r = 0; r < piece->rows; ++r) {
-        for (size_t c = 0; c < piece->cols; ++c) {
-            uint8_t type = (*table)[piece->orient_index][r][c];
-            if (type != TYPE_NONE) {
-                /* copy piece to matrix */
-                if (!matrix_out_bounds(matrix, piece->y + r, piece->x + c)) {
-                    matrix->table[piece->y + r][piece->x + c] = type;
-                }
+/* Copy the piece into the matrix. Return the number of rows that the piece filled. */
+uint32_t piece_place(const piece_t* piece, matrix_t* matrix) {
+    const shape_t* shape = piece_shape(piece);
+    for (size_t i = 0; i < 4; ++i) {
+        int32_t row = piece->y + shape->cells[i][0];
+        int32_t col = piece->x + shape->cells[i][1];
+        /* copy piece to matrix */
+        if (matrix_out_bounds(matrix, row, col)) {
+            continue;
+        }
+        if (matrix->table[row][col] == TYPE_NONE) {
+            ++matrix->row_counts[row];
+            ++matrix->col_counts[col];
+            ++matrix->cells;
+            matrix->hash ^= zobrist_key(row, col);
+            if (matrix->heights[col] < matrix->rows - row) {
+                matrix->heights[col] = matrix->rows - row;
             }
         }
+        matrix->table[row][col] = piece->type;
+        matrix->bits[row] |= 1u << (col + MATRIX_WALL_BITS);
+        matrix->col_bits[col] |= 1u << row;
+    }
+    uint32_t filled_rows = 0;
+    for (int32_t r = shape->min_y; r <= shape->max_y; ++r) {
+        int32_t row = piece->y + r;
+        if (row >= 0 && row < (int64_t)matrix->rows && matrix_row_full(matrix, row)) {
+            ++filled_rows;
+        }
     }
+    return filled_rows;
+}
+
+/*
+ * Copy the piece into the matrix and clear the rows it filled, recording what changed in `undo`
+ * so that matrix_undo can restore the matrix. The matrix should not have any filled rows before
+ * the piece is placed. Return the number of cleared rows.
+ */
+uint32_t piece_place_clean(const piece_t* piece, matrix_t* matrix, matrix_undo_t* undo) {
+    const shape_t* shape = piece_shape(piece);
+    memcpy(undo->heights, matrix->heights, sizeof(undo->heights));
+    memcpy(undo->col_bits, matrix->col_bits, sizeof(undo->col_bits));
+    undo->hash = matrix->hash;
+    undo->num_cells = 0;
+    for (size_t i = 0; i < 4; ++i) {
+        int32_t row = piece->y + shape->cells[i][0];
+        int32_t col = piece->x + shape->cells[i][1];
+        if (!matrix_out_bounds(matrix, row, col)) {
+            undo->cells[undo->num_cells][0] = row;
+            undo->cells[undo->num_cells][1] = col;
+            undo->cells[undo->num_cells][2] = matrix->table[row][col];
+            ++undo->num_cells;
+        }
+    }
+    uint32_t filled_rows = piece_place(piece, matrix);
+    undo->cleared_mask = 0;
+    if (filled_rows == 0) {
+        return 0;
+    }
+    uint32_t saved = 0;
+    for (int32_t r = shape->min_y; r <= shape->max_y; ++r) {
+        int32_t row = piece->y + r;
+        if (row >= 0 && row < (int64_t)matrix->rows && matrix_row_full(matrix, row)) {
+            memcpy(undo->cleared[saved], matrix->table[row], MATRIX_STRIDE);
+            ++saved;
+        }
+    }
+    return matrix_clean(matrix, &undo->cleared_mask);
 }
 
 void piece_free(piece_t* piece) {
-    free(piece);
+    SDL_free(piece);
 }
 
 /*
  * Create a new matrix. The matrix should be at least four columns wide for the game to work
- * properly. Return NULL on failure.
+ * properly. The matrix is a single allocation aligned to MATRIX_ALIGN bytes. Return NULL on
+ * failure.
  */
 matrix_t* matrix_new(uint32_t rows, uint32_t cols, uint32_t hidden_rows) {
-    if (rows < hidden_rows) {
+    void* block = SDL_malloc(sizeof(matrix_t) + MATRIX_ALIGN - 1);
+    if (!block) {
         return NULL;
     }
-    matrix_t* matrix = malloc(sizeof(matrix_t));
-    if (!matrix) {
+    uintptr_t aligned = ((uintptr_t)block + MATRIX_ALIGN - 1) & ~(uintptr_t)(MATRIX_ALIGN - 1);
+    matrix_t* matrix = (matrix_t*)aligned;
+    if (!matrix_init(matrix, rows, cols, hidden_rows)) {
+        SDL_free(block);
         return NULL;
     }
-    matrix->table = malloc(rows * sizeof(uint8_t*));
-    if (!matrix->table) {
-        free(matrix);
-        return NULL;
-    }
-    for (size_t r = 0; r < rows; ++r) {
-        matrix->table[r] = malloc(cols * sizeof(uint8_t));
-        if (!matrix->table[r]) {
-            for (size_t r2 = 0; r2 < r; ++r2) {
-                free(matrix->table[r2]);
-            }
-            free(matrix->table);
-            free(matrix);
-            return NULL;
-        }
-        for (size_t c = 0; c < cols; ++c) {
-            matrix->table[r][c] = TYPE_NONE;
-        }
+    matrix->block = block;
+    return matrix;
+}
+
+/*
+ * Set up a matrix in memory owned by the caller, such as a matrix declared on the stack. A matrix
+ * set up this way must not be passed to matrix_free. Return whether the dimensions are supported.
+ */
+bool matrix_init(matrix_t* matrix, uint32_t rows, uint32_t cols, uint32_t hidden_rows) {
+    if (rows < hidden_rows || rows > MATRIX_MAX_ROWS || cols > MATRIX_MAX_COLS) {
+        return false;
     }
     matrix->rows = rows;
     matrix->cols = cols;
     matrix->hidden_rows = hidden_rows;
-    return matrix;
+    matrix->block = NULL;
+    matrix_clear(matrix);
+    return true;
 }
 
 bool matrix_row_full(const matrix_t* matrix, const uint32_t row) {
-    bool is_row_full = true;
-    for (size_t c = 0; c < matrix->cols; ++c) {
-        uint8_t type = matrix->table[row][c];
-        if (type == TYPE_NONE) {
-            is_row_full = false;
-            break;
-        }
-    }
-    return is_row_full;
+    return matrix->bits[row] == MATRIX_ROW_FULL;
 }
 
 bool matrix_out_bounds(const matrix_t* matrix, int32_t row, int32_t col) {
@@ -407,58 +502,216 @@ bool matrix_copy_table(matrix_t* dest, const matrix_t* src) {
     if (dest->rows != src->rows || dest->hidden_rows != src->hidden_rows || dest->cols != src->cols) {
         return false;
     }
-    for (size_t r = 0; r < src->rows; ++r) {
-        for (size_t c = 0; c < src->cols; ++c) {
-            dest->table[r][c] = src->table[r][c];
-        }
-    }
+    memcpy(dest, src, offsetof(matrix_t, rows));
     return true;
 }
 
 void matrix_clear(matrix_t* matrix) {
+    memset(matrix->table, TYPE_NONE, sizeof(matrix->table));
+    memset(matrix->heights, 0, sizeof(matrix->heights));
+    memset(matrix->col_bits, 0, sizeof(matrix->col_bits));
+    memset(matrix->col_counts, 0, sizeof(matrix->col_counts));
+    memset(matrix->row_counts, 0, sizeof(matrix->row_counts));
+    matrix->cells = 0;
+    matrix->hash = 0;
+    uint32_t empty_row = matrix_empty_row(matrix);
     for (size_t r = 0; r < matrix->rows; ++r) {
-        memset(matrix->table[r], 0, matrix->cols);
+        matrix->bits[r] = empty_row;
+    }
+    for (size_t r = matrix->rows; r < matrix->rows + MATRIX_FLOOR_ROWS; ++r) {
+        matrix->bits[r] = MATRIX_ROW_FULL;
     }
 }
 
-/* Shift the stack down by one row, starting from a given row. */
-void matrix_shift_stack(matrix_t* matrix, uint32_t from_row) {
-    for (size_t r = from_row; r > 0; --r) {
-        for (size_t c = 0; c < matrix->cols; ++c) {
-            matrix->table[r][c] = matrix->table[r - 1][c];
+/*
+ * Fill each column `c` from the bottom with `heights[c]` blocks of type `type` and empty the rest
+ * of the matrix, which leaves a stack without holes. Every height must be at most the number of
+ * rows.
+ */
+void matrix_fill(matrix_t* matrix, const uint8_t* heights, uint8_t type) {
+    matrix_clear(matrix);
+    for (uint32_t c = 0; c < matrix->cols; ++c) {
+        for (uint32_t r = matrix->rows - heights[c]; r < matrix->rows; ++r) {
+            matrix->table[r][c] = type;
+            matrix->bits[r] |= 1u << (c + MATRIX_WALL_BITS);
+            matrix->col_bits[c] |= 1u << r;
+            ++matrix->row_counts[r];
+            matrix->hash ^= zobrist_key(r, c);
         }
+        matrix->heights[c] = heights[c];
+        matrix->col_counts[c] = heights[c];
+        matrix->cells += heights[c];
     }
+}
+
+/*
+ * Clear filled rows and shift stack down in a single pass from the bottom row up, moving each
+ * remaining row at most once. If there are no filled rows, then the matrix will not be affected.
+ * If `cleared_rows` is not NULL, bit `r` of it is set for each row `r` that was cleared. Return
+ * the number of cleared rows.
+ */
+uint32_t matrix_clean(matrix_t* matrix, uint32_t* cleared_rows) {
+    uint32_t cleared = 0;
+    uint32_t mask = 0;
+    int32_t dest = matrix->rows - 1;
+    for (int32_t r = matrix->rows - 1; r >= 0; --r) {
+        if (matrix_row_full(matrix, r)) {
+            ++cleared;
+            mask |= 1u << r;
+            matrix->hash ^= zobrist_row(matrix, r, MATRIX_ROW_FULL);
+            continue;
+        }
+        if (dest != r) {
+            /* only the rows that move change the hash */
+            matrix->hash ^= zobrist_row(matrix, r, matrix->bits[r])
+                            ^ zobrist_row(matrix, dest, matrix->bits[r]);
+            memcpy(matrix->table[dest], matrix->table[r], MATRIX_STRIDE);
+            matrix->bits[dest] = matrix->bits[r];
+            matrix->row_counts[dest] = matrix->row_counts[r];
+        }
+        --dest;
+    }
+    if (cleared_rows) {
+        *cleared_rows = mask;
+    }
+    if (cleared == 0) {
+        return 0;
+    }
+    uint32_t empty_row = matrix_empty_row(matrix);
+    for ( ; dest >= 0; --dest) {
+        memset(matrix->table[dest], TYPE_NONE, MATRIX_STRIDE);
+        matrix->bits[dest] = empty_row;
+        matrix->row_counts[dest] = 0;
+    }
+    /*
+     * Take the cleared rows out of each column word from the top down: the rows above a cleared
+     * row move down one row, and the rows under it, including the cleared rows still to come,
+     * stay where they are. Each column then lost `cleared` cells, and its top is its lowest bit.
+     */
+    matrix->cells -= cleared * matrix->cols;
     for (size_t c = 0; c < matrix->cols; ++c) {
-        matrix->table[0][c] = TYPE_NONE;
+        uint32_t col_bits = matrix->col_bits[c];
+        for (uint32_t rows = mask; rows != 0; rows &= rows - 1) {
+            uint32_t row = rows & (0u - rows);
+            col_bits = ((col_bits & (row - 1)) << 1) | (col_bits & ~(row - 1) & ~row);
+        }
+        matrix->col_bits[c] = col_bits;
+        matrix->heights[c] = col_bits != 0 ? matrix->rows - MATRIX_LOWEST_BIT(col_bits) : 0;
+        matrix->col_counts[c] -= cleared;
     }
+    return cleared;
 }
 
 /*
- * Clear filled rows and shift stack down. If there are no filled rows, then the matrix will not
- * be affected.
+ * Take back a call to piece_place_clean. The matrix must not have been changed in any other way
+ * since then.
  */
-void matrix_clean(matrix_t* matrix) {
-    for (size_t r = 0; r < matrix->rows; ++r) {
-        if (matrix_row_full(matrix, r)) {
-            for (size_t c = 0; c < matrix->cols; ++c) {
-                matrix->table[r][c] = TYPE_NONE;
+void matrix_undo(matrix_t* matrix, const matrix_undo_t* undo) {
+    if (undo->cleared_mask != 0) {
+        /*
+         * Put the cleared rows back from the top down. A row that was kept was moved down by the
+         * number of cleared rows under it, and has not been overwritten yet.
+         */
+        uint32_t below = 0;
+        int32_t lowest = 0;
+        for (int32_t r = 0; r < (int64_t)matrix->rows; ++r) {
+            if (undo->cleared_mask & (1u << r)) {
+                ++below;
+                lowest = r;
+            }
+        }
+        uint32_t cleared = 0;
+        for (int32_t r = 0; r <= lowest; ++r) {
+            if (undo->cleared_mask & (1u << r)) {
+                memcpy(matrix->table[r], undo->cleared[cleared], MATRIX_STRIDE);
+                matrix->bits[r] = MATRIX_ROW_FULL;
+                matrix->row_counts[r] = matrix->cols;
+                ++cleared;
+                --below;
+            } else {
+                memcpy(matrix->table[r], matrix->table[r + below], MATRIX_STRIDE);
+                matrix->bits[r] = matrix->bits[r + below];
+                matrix->row_counts[r] = matrix->row_counts[r + below];
             }
-            matrix_shift_stack(matrix, r);
+        }
+        matrix->cells += cleared * matrix->cols;
+        for (size_t c = 0; c < matrix->cols; ++c) {
+            matrix->col_counts[c] += cleared;
+        }
+    }
+    for (size_t i = 0; i < undo->num_cells; ++i) {
+        uint32_t row = undo->cells[i][0];
+        uint32_t col = undo->cells[i][1];
+        uint8_t type = undo->cells[i][2];
+        matrix->table[row][col] = type;
+        if (type == TYPE_NONE) {
+            matrix->bits[row] &= ~(1u << (col + MATRIX_WALL_BITS));
+            --matrix->row_counts[row];
+            --matrix->col_counts[col];
+            --matrix->cells;
         }
     }
+    memcpy(matrix->heights, undo->heights, sizeof(matrix->heights));
+    memcpy(matrix->col_bits, undo->col_bits, sizeof(matrix->col_bits));
+    matrix->hash = undo->hash;
 }
 
-void matrix_free(matrix_t* matrix) {
-    if (!matrix) {
-        return;
+/* Return the number of rows from the bottom of the matrix to the top block of a column. */
+uint32_t matrix_col_height(const matrix_t* matrix, uint32_t col) {
+    return matrix->heights[col];
+}
+
+/* Return the number of filled cells in a column. */
+uint32_t matrix_col_count(const matrix_t* matrix, uint32_t col) {
+    return matrix->col_counts[col];
+}
+
+/* Return the number of filled cells in a row. */
+uint32_t matrix_row_count(const matrix_t* matrix, uint32_t row) {
+    return matrix->row_counts[row];
+}
+
+/* Return the number of filled cells in the matrix. */
+uint32_t matrix_cell_count(const matrix_t* matrix) {
+    return matrix->cells;
+}
+
+/*
+ * Return a 64-bit hash of which cells of the matrix are filled, but not by which type of piece.
+ * It is the exclusive or of a key for each filled cell (Zobrist hashing), kept up to date by
+ * piece_place, matrix_clean and matrix_undo, so boards can be told apart without comparing them.
+ */
+uint64_t matrix_hash(const matrix_t* matrix) {
+    return matrix->hash;
+}
+
+/* Return what matrix_hash should be, computed from the cells of the table alone. */
+uint64_t matrix_hash_table(const matrix_t* matrix) {
+    uint64_t hash = 0;
+    for (uint32_t r = 0; r < matrix->rows; ++r) {
+        for (uint32_t c = 0; c < matrix->cols; ++c) {
+            if (matrix->table[r][c] != TYPE_NONE) {
+                hash ^= zobrist_key(r, c);
+            }
+        }
     }
-    for (size_t r = 0; r < matrix->rows; ++r) {
-        if (matrix->table[r]) {
-            free(matrix->table[r]);
+    return hash;
+}
+
+/* Return the height of the highest column. */
+uint32_t matrix_stack_height(const matrix_t* matrix) {
+    uint32_t height = 0;
+    for (size_t c = 0; c < matrix->cols; ++c) {
+        if (matrix->heights[c] > height) {
+            height = matrix->heights[c];
         }
     }
-    if (matrix->table) {
-        free(matrix->table);
+    return height;
+}
+
+void matrix_free(matrix_t* matrix) {
+    if (!matrix) {
+        return;
     }
-    free(matrix);
+    SDL_free(matrix->block);
 }
@@ -35,6 +35,41 @@ enum {
     MATRIX_HIDDEN_ROWS = 2,
 };
 
+/*
+ * Each row of the occupancy bitboard is one word. Column `c` is stored in bit
+ * `c + MATRIX_WALL_BITS`; every other bit is a wall and is always set. A few full rows are kept
+ * under the last row as a floor, so a piece can be tested against the board with one AND per
+ * piece row.
+ */
+enum {
+    MATRIX_WALL_BITS = 4,
+    MATRIX_FLOOR_ROWS = 4,
+};
+
+/*
+ * The whole matrix lives in one fixed-size block so it can be declared on the stack and copied
+ * with one memcpy. MATRIX_STRIDE is the distance in bytes between two rows of the table.
+ */
+enum {
+    MATRIX_MAX_ROWS = 32,
+    MATRIX_STRIDE = 16,
+    MATRIX_MAX_COLS = MATRIX_STRIDE,
+    MATRIX_ALIGN = 64,
+};
+
+#define MATRIX_ROW_FULL UINT32_MAX
+
+/*
+ * Return the index of the lowest set bit of `x`, which must not be 0. Applied to a column word of
+ * the matrix, this is the row of the top block of the column. It multiplies the lowest bit by a
+ * de Bruijn sequence, so it has no branches and needs no compiler builtins. `x` is evaluated
+ * twice.
+ */
+#define MATRIX_LOWEST_BIT(x) \
+    ((uint32_t)MATRIX_DEBRUIJN[(uint32_t)(((x) & (0u - (x))) * 0x077CB531u) >> 27])
+
+extern const uint8_t MATRIX_DEBRUIJN[32];
+
 enum {
     TYPE_NONE,
     TYPE_LINE,
@@ -46,8 +81,22 @@ enum {
     TYPE_Z,
 };
 
+/*
+ * One orientation of a tetromino. Rows and columns are relative to the top-left corner of the
+ * piece's 3x3 or 4x4 box.
+ */
 typedef struct {
-    const void* table;
+    uint8_t row_masks[4]; /* bit `col` of row_masks[row] is set for each block */
+    uint8_t cells[4][2]; /* { row, col } of each block */
+    int8_t bottoms[4]; /* bottoms[col] is the row of the lowest block in a column, -1 if none */
+    uint8_t min_x;
+    uint8_t max_x;
+    uint8_t min_y;
+    uint8_t max_y;
+} shape_t;
+
+typedef struct {
+    const shape_t* shapes; /* shapes[orient_index] */
     uint32_t orientations;
     uint32_t rows;
     uint32_t cols;
@@ -58,30 +107,73 @@ typedef struct {
 } piece_t;
 
 typedef struct {
-    uint8_t** table; /* table[row][col] */
+    /* the state of the board, copied as a whole by matrix_copy_table */
+    uint8_t table[MATRIX_MAX_ROWS][MATRIX_STRIDE]; /* table[row][col] */
+    uint32_t bits[MATRIX_MAX_ROWS + MATRIX_FLOOR_ROWS]; /* bits[row], see MATRIX_WALL_BITS */
+    uint32_t col_bits[MATRIX_MAX_COLS]; /* bit `row` of col_bits[col] is set for each block */
+    uint8_t heights[MATRIX_MAX_COLS]; /* rows from the bottom to the top block of each column */
+    uint8_t col_counts[MATRIX_MAX_COLS]; /* filled cells in each column */
+    uint8_t row_counts[MATRIX_MAX_ROWS]; /* filled cells in each row */
+    uint32_t cells; /* filled cells in the whole matrix */
+    uint64_t hash; /* Zobrist hash of the filled cells, see matrix_hash */
+
     uint32_t rows;
     uint32_t hidden_rows;
     uint32_t cols;
+    void* block; /* allocation made by matrix_new, NULL if the matrix was made by matrix_init */
 } matrix_t;
 
+/*
+ * Enough information to take back one call to piece_place_clean: the cells the piece was copied
+ * to, the rows that were cleared, and the column heights and words from before the piece was
+ * placed.
+ */
+enum {
+    MATRIX_UNDO_ROWS = 4,
+};
+
+typedef struct {
+    uint8_t cells[4][3]; /* { row, col, previous type } of each cell the piece was copied to */
+    uint32_t num_cells;
+    uint32_t cleared_mask; /* bit `r` is set for each cleared row `r` */
+    uint8_t cleared[MATRIX_UNDO_ROWS][MATRIX_STRIDE]; /* cleared rows, from the top down */
+    uint8_t heights[MATRIX_MAX_COLS];
+    uint32_t col_bits[MATRIX_MAX_COLS];
+    uint64_t hash;
+} matrix_undo_t;
+
 piece_t* piece_new(const matrix_t* matrix, uint8_t type);
+bool     piece_init(piece_t* piece, const matrix_t* matrix, uint8_t type);
 piece_t* piece_new_rand(const matrix_t* matrix);
+const shape_t* piece_shape(const piece_t* piece);
 bool     piece_collides(const piece_t* piece, const matrix_t* matrix);
 bool     piece_move_down(piece_t* piece, const matrix_t* matrix);
+uint32_t piece_drop_distance(const piece_t* piece, const matrix_t* matrix);
+uint32_t piece_hard_drop(piece_t* piece, const matrix_t* matrix);
 bool     piece_move_left(piece_t* piece, const matrix_t* matrix);
 bool     piece_move_right(piece_t* piece, const matrix_t* matrix);
 bool     piece_rotate_ccw(piece_t* piece, const matrix_t* matrix);
 bool     piece_rotate_cw(piece_t* piece, const matrix_t* matrix);
-void     piece_place(const piece_t* piece, matrix_t* matrix);
+uint32_t piece_place(const piece_t* piece, matrix_t* matrix);
+uint32_t piece_place_clean(const piece_t* piece, matrix_t* matrix, matrix_undo_t* undo);
 void     piece_free(piece_t*);
 
 matrix_t* matrix_new(uint32_t rows, uint32_t cols, uint32_t hidden_rows);
+bool      matrix_init(matrix_t* matrix, uint32_t rows, uint32_t cols, uint32_t hidden_rows);
 bool      matrix_row_full(const matrix_t* matrix, uint32_t row);
 bool      matrix_out_bounds(const matrix_t* matrix, int32_t row, int32_t col);
 bool      matrix_copy_table(matrix_t* dest, const matrix_t* src);
 void      matrix_clear(matrix_t* matrix);
-void      matrix_shift_stack(matrix_t* matrix, uint32_t from_row);
-void      matrix_clean(matrix_t* matrix);
+void      matrix_fill(matrix_t* matrix, const uint8_t* heights, uint8_t type);
+uint32_t  matrix_clean(matrix_t* matrix, uint32_t* cleared_rows);
+void      matrix_undo(matrix_t* matrix, const matrix_undo_t* undo);
+uint32_t  matrix_col_height(const matrix_t* matrix, uint32_t col);
+uint32_t  matrix_col_count(const matrix_t* matrix, uint32_t col);
+uint32_t  matrix_row_count(const matrix_t* matrix, uint32_t row);
+uint32_t  matrix_cell_count(const matrix_t* matrix);
+uint64_t  matrix_hash(const matrix_t* matrix);
+uint64_t  matrix_hash_table(const matrix_t* matrix);
+uint32_t  matrix_stack_height(const matrix_t* matrix);
 void      matrix_free(matrix_t* matrix);
 
 #endif /* GAME_H */
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2024-2025 Oxoboo
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE
+ * AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <string.h>
+#include "movegen.h"
+
+/* Pack the position and orientation of a piece into a state index. */
+uint32_t movegen_state(const piece_t* piece) {
+    return ((piece->orient_index * MOVEGEN_HEIGHT) + (piece->y + MOVEGEN_MARGIN)) * MOVEGEN_WIDTH
+        + (piece->x + MOVEGEN_MARGIN);
+}
+
+/* Unpack a state index into the position and orientation of a piece. */
+static void movegen_unpack(uint32_t state, piece_t* piece) {
+    piece->x = (int32_t)(state % MOVEGEN_WIDTH) - MOVEGEN_MARGIN;
+    state /= MOVEGEN_WIDTH;
+    piece->y = (int32_t)(state % MOVEGEN_HEIGHT) - MOVEGEN_MARGIN;
+    piece->orient_index = state / MOVEGEN_HEIGHT;
+}
+
+/* Make one move with the piece. Return whether the piece was able to be moved. */
+bool movegen_apply(uint8_t move, piece_t* piece, const matrix_t* matrix) {
+    switch (move) {
+        case MOVE_CW:
+            return piece_rotate_cw(piece, matrix);
+        case MOVE_CCW:
+            return piece_rotate_ccw(piece, matrix);
+        case MOVE_LEFT:
+            return piece_move_left(piece, matrix);
+        case MOVE_RIGHT:
+            return piece_move_right(piece, matrix);
+        case MOVE_DOWN:
+            return piece_move_down(piece, matrix);
+        default:
+            return false;
+    }
+}
+
+/*
+ * Find every position where the piece can lock, starting from its current position. This is a
+ * breadth-first search over positions and orientations using the same moves and rotations as the
+ * game, so it finds tucks under overhangs and spins as well as straight drops, each with a
+ * shortest path of moves. A piece locks where it can not move down. Return the number of
+ * placements found. If the piece collides with the stack where it is, there are none.
+ */
+uint32_t movegen_run(movegen_t* gen, const piece_t* piece, const matrix_t* matrix) {
+    memset(gen->visited, 0, sizeof(gen->visited));
+    gen->num_placements = 0;
+    gen->num_states = 0;
+    if (piece_collides(piece, matrix)) {
+        return 0;
+    }
+    gen->start = movegen_state(piece);
+    gen->visited[gen->start / 32] |= 1u << (gen->start % 32);
+    gen->queue[gen->num_states++] = gen->start;
+
+    piece_t from = *piece;
+    for (uint32_t head = 0; head < gen->num_states; ++head) {
+        uint16_t state = gen->queue[head];
+        movegen_unpack(state, &from);
+        for (uint8_t move = 0; move < NUM_MOVES; ++move) {
+            piece_t to = from;
+            if (!movegen_apply(move, &to, matrix)) {
+                if (move == MOVE_DOWN) {
+                    gen->placements[gen->num_placements++] = state;
+                }
+                continue;
+            }
+            uint32_t next = movegen_state(&to);
+            if (gen->visited[next / 32] & (1u << (next % 32))) {
+                continue;
+            }
+            gen->visited[next / 32] |= 1u << (next % 32);
+            gen->parent[next] = state;
+            gen->move[next] = move;
+            gen->queue[gen->num_states++] = next;
+        }
+    }
+    return gen->num_placements;
+}
+
+/* Move a piece to one of the placements found by the last search. */
+void movegen_placement(const movegen_t* gen, uint32_t index, piece_t* piece) {
+    movegen_unpack(gen->placements[index], piece);
+}
+
+/*
+ * Write the moves that bring the piece from where the last search started to one of the
+ * placements it found. `states[i]` is the state of the piece before `moves[i]`, and the last
+ * entry of `states` is the placement itself, so `states` needs room for one more entry than
+ * `moves`. Both arrays need room for MOVEGEN_MAX_STATES moves. Return the number of moves.
+ */
+uint32_t movegen_path(const movegen_t* gen, uint32_t index, uint8_t* moves, uint16_t* states) {
+    uint32_t length = 0;
+    for (uint16_t state = gen->placements[index]; state != gen->start; state = gen->parent[state]) {
+        ++length;
+    }
+    uint16_t state = gen->placements[index];
+    states[length] = state;
+    for (uint32_t i = length; i > 0; --i) {
+        moves[i - 1] = gen->move[state];
+        state = gen->parent[state];
+        states[i - 1] = state;
+    }
+    return length;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2024-2025 Oxoboo
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE
+ * AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef MOVEGEN_H
+#define MOVEGEN_H
+
+#include <stdint.h>
+#include "matrix.h"
+
+enum {
+    MOVE_CW,
+    MOVE_CCW,
+    MOVE_LEFT,
+    MOVE_RIGHT,
+    MOVE_DOWN,
+    NUM_MOVES,
+};
+
+/*
+ * A piece's box can stick out past the left wall and above the top of the matrix by a few cells,
+ * so positions are offset by MOVEGEN_MARGIN before they are packed into a state index.
+ */
+enum {
+    MOVEGEN_MARGIN = 3,
+    MOVEGEN_WIDTH = MATRIX_MAX_COLS + MOVEGEN_MARGIN,
+    MOVEGEN_HEIGHT = MATRIX_MAX_ROWS + MOVEGEN_MARGIN,
+    MOVEGEN_MAX_STATES = 4 * MOVEGEN_WIDTH * MOVEGEN_HEIGHT,
+};
+
+/*
+ * Search state of the move generator. Every (x, y, orientation) a piece can reach is one state,
+ * and each state remembers the state and the move it was first reached from.
+ */
+typedef struct {
+    uint32_t visited[(MOVEGEN_MAX_STATES + 31) / 32];
+    uint16_t queue[MOVEGEN_MAX_STATES];
+    uint16_t parent[MOVEGEN_MAX_STATES];
+    uint8_t move[MOVEGEN_MAX_STATES];
+    uint16_t placements[MOVEGEN_MAX_STATES]; /* states where the piece locks */
+    uint32_t num_placements;
+    uint32_t num_states; /* states reached by the last search */
+    uint16_t start;
+} movegen_t;
+
+uint32_t movegen_run(movegen_t* gen, const piece_t* piece, const matrix_t* matrix);
+uint32_t movegen_state(const piece_t* piece);
+void     movegen_placement(const movegen_t* gen, uint32_t index, piece_t* piece);
+uint32_t movegen_path(const movegen_t* gen, uint32_t index, uint8_t* moves, uint16_t* states);
+bool     movegen_apply(uint8_t move, piece_t* piece, const matrix_t* matrix);
+
+#endif /* MOVEGEN_H */
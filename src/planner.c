@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2024-2025 Oxoboo
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE
+ * AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "SDL_cpuinfo.h"
+#include "SDL_stdinc.h"
+#include "planner.h"
+
+/* Wait for jobs from planner_post and do them until planner_free is called. */
+static int planner_run(void* data) {
+    planner_t* planner = data;
+    for (;;) {
+        SDL_SemWait(planner->jobs);
+        if (SDL_AtomicGet(&planner->state) == PLANNER_QUIT) {
+            return 0;
+        }
+        bot_t* bot = planner->bot;
+        int32_t err_value = bot_step(bot, (uint64_t)planner->budget_us * 1000);
+        if (err_value == 0) {
+            err_value = bot_search_finish(bot, &bot->board);
+        }
+        planner->err_value = err_value;
+        /* the atomic operation makes the bot's new state visible to the main thread */
+        SDL_AtomicCAS(&planner->state, PLANNER_BUSY, PLANNER_READY);
+    }
+}
+
+/*
+ * Create a planner that works with `bot` on its own thread. Each job chooses the next piece and
+ * searches ahead from it for at most about `budget_us` microseconds. Return NULL if there is only
+ * one CPU, or on failure, in which case the bot can still be stepped on the main thread.
+ */
+planner_t* planner_new(bot_t* bot, uint32_t budget_us) {
+    if (SDL_GetCPUCount() < 2) {
+        return NULL;
+    }
+    planner_t* planner = SDL_malloc(sizeof(planner_t));
+    if (!planner) {
+        return NULL;
+    }
+    planner->bot = bot;
+    planner->budget_us = budget_us;
+    planner->err_value = 0;
+    SDL_AtomicSet(&planner->state, PLANNER_IDLE);
+    planner->jobs = SDL_CreateSemaphore(0);
+    if (!planner->jobs) {
+        SDL_free(planner);
+        return NULL;
+    }
+    planner->thread = SDL_CreateThread(planner_run, "planner", planner);
+    if (!planner->thread) {
+        SDL_DestroySemaphore(planner->jobs);
+        SDL_free(planner);
+        return NULL;
+    }
+    return planner;
+}
+
+/*
+ * Hand the bot to the worker thread to finish what bot_start started. The main thread must not use
+ * the bot again until planner_ready returns true.
+ */
+void planner_post(planner_t* planner) {
+    SDL_AtomicSet(&planner->state, PLANNER_BUSY);
+    SDL_SemPost(planner->jobs);
+}
+
+/*
+ * Return whether the bot belongs to the main thread, taking the result of the last job if it is
+ * done. This never waits. `err_value` is set to the job's result when one is taken.
+ */
+bool planner_ready(planner_t* planner, int32_t* err_value) {
+    if (SDL_AtomicCAS(&planner->state, PLANNER_READY, PLANNER_IDLE)) {
+        *err_value = planner->err_value;
+        return true;
+    }
+    return SDL_AtomicGet(&planner->state) == PLANNER_IDLE;
+}
+
+/* Stop the worker thread, waiting for the job it is doing, and free the planner. */
+void planner_free(planner_t* planner) {
+    if (!planner) {
+        return;
+    }
+    SDL_AtomicSet(&planner->state, PLANNER_QUIT);
+    SDL_SemPost(planner->jobs);
+    SDL_WaitThread(planner->thread, NULL);
+    SDL_DestroySemaphore(planner->jobs);
+    SDL_free(planner);
+}
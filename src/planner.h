@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2024-2025 Oxoboo
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE
+ * AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "SDL_atomic.h"
+#include "SDL_mutex.h"
+#include "SDL_thread.h"
+#include "bot.h"
+
+/* who may use the bot, see planner_post */
+enum {
+    PLANNER_IDLE, /* the main thread */
+    PLANNER_BUSY, /* the worker thread */
+    PLANNER_READY, /* the main thread, once it takes the result with planner_ready */
+    PLANNER_QUIT,
+};
+
+/* A worker thread that chooses the next piece and its placement while animations play. */
+typedef struct {
+    bot_t* bot;
+    SDL_Thread* thread;
+    SDL_sem* jobs;
+    SDL_atomic_t state;
+    int32_t err_value; /* result of the last job, written before the state becomes READY */
+    uint32_t budget_us;
+} planner_t;
+
+planner_t* planner_new(bot_t* bot, uint32_t budget_us);
+void       planner_post(planner_t* planner);
+bool       planner_ready(planner_t* planner, int32_t* err_value);
+void       planner_free(planner_t* planner);
+
+#endif /* PLANNER_H */
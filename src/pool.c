@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2024-2025 Oxoboo
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE
+ * AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "SDL_stdinc.h"
+#include "pool.h"
+
+/* Take tasks of the current job until there are none left. */
+static void pool_work(pool_t* pool, uint32_t worker) {
+    for (;;) {
+        uint32_t task = SDL_AtomicAdd(&pool->next_task, 1);
+        if (task >= pool->num_tasks) {
+            return;
+        }
+        pool->task(pool->data, worker, task);
+    }
+}
+
+static int pool_run_thread(void* data) {
+    pool_worker_t* worker = data;
+    pool_t* pool = worker->pool;
+    for (;;) {
+        SDL_SemWait(pool->start);
+        if (SDL_AtomicGet(&pool->quit)) {
+            return 0;
+        }
+        pool_work(pool, worker->index);
+        SDL_SemPost(pool->done);
+    }
+}
+
+/*
+ * Create a pool of `num_threads` threads, at most POOL_MAX_THREADS. The thread that starts a job
+ * works on it too, so a job can have `num_threads + 1` workers. Return NULL on failure.
+ */
+pool_t* pool_new(uint32_t num_threads) {
+    if (num_threads > POOL_MAX_THREADS) {
+        return NULL;
+    }
+    pool_t* pool = SDL_malloc(sizeof(pool_t));
+    if (!pool) {
+        return NULL;
+    }
+    pool->num_threads = 0;
+    pool->num_tasks = 0;
+    SDL_AtomicSet(&pool->next_task, 0);
+    SDL_AtomicSet(&pool->quit, 0);
+    pool->start = SDL_CreateSemaphore(0);
+    pool->done = SDL_CreateSemaphore(0);
+    if (!pool->start || !pool->done) {
+        pool_free(pool);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < num_threads; ++i) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        pool->threads[i] = SDL_CreateThread(pool_run_thread, "pool", &pool->workers[i]);
+        if (!pool->threads[i]) {
+            pool_free(pool);
+            return NULL;
+        }
+        ++pool->num_threads;
+    }
+    return pool;
+}
+
+/*
+ * Start calling `task` for every task number below `num_tasks` on the pool's threads, and return
+ * without waiting. The calling thread can take tasks too with pool_work_one, as worker number
+ * `num_threads`, and must call pool_wait or pool_cancel before the next job. Tasks may run in any
+ * order, so they must not depend on each other.
+ */
+void pool_start(pool_t* pool, pool_task_t task, void* data, uint32_t num_tasks) {
+    pool->task = task;
+    pool->data = data;
+    pool->num_tasks = num_tasks;
+    SDL_AtomicSet(&pool->next_task, 0);
+    for (uint32_t i = 0; i < pool->num_threads; ++i) {
+        SDL_SemPost(pool->start);
+    }
+}
+
+/*
+ * Do one task of the job started by pool_start on the calling thread. Return false if there was
+ * no task left to take.
+ */
+bool pool_work_one(pool_t* pool) {
+    uint32_t task = SDL_AtomicAdd(&pool->next_task, 1);
+    if (task >= pool->num_tasks) {
+        return false;
+    }
+    pool->task(pool->data, pool->num_threads, task);
+    return true;
+}
+
+/*
+ * Do the tasks of the job started by pool_start that nobody has taken yet on the calling thread,
+ * then wait until the pool's threads are done with theirs. Once pool_work_one has returned false,
+ * this only waits for the tasks the threads are in the middle of.
+ */
+void pool_wait(pool_t* pool) {
+    pool_work(pool, pool->num_threads);
+    for (uint32_t i = 0; i < pool->num_threads; ++i) {
+        SDL_SemWait(pool->done);
+    }
+}
+
+/* Like pool_wait, but drop the tasks that nobody has taken yet instead of doing them. */
+void pool_cancel(pool_t* pool) {
+    SDL_AtomicSet(&pool->next_task, pool->num_tasks);
+    pool_wait(pool);
+}
+
+/* Call `task` for every task number below `num_tasks` like pool_start, and wait for them all. */
+void pool_run(pool_t* pool, pool_task_t task, void* data, uint32_t num_tasks) {
+    pool_start(pool, task, data, num_tasks);
+    pool_wait(pool);
+}
+
+/* Stop the pool's threads and free the pool. */
+void pool_free(pool_t* pool) {
+    if (!pool) {
+        return;
+    }
+    SDL_AtomicSet(&pool->quit, 1);
+    for (uint32_t i = 0; i < pool->num_threads; ++i) {
+        SDL_SemPost(pool->start);
+    }
+    for (uint32_t i = 0; i < pool->num_threads; ++i) {
+        SDL_WaitThread(pool->threads[i], NULL);
+    }
+    if (pool->start) {
+        SDL_DestroySemaphore(pool->start);
+    }
+    if (pool->done) {
+        SDL_DestroySemaphore(pool->done);
+    }
+    SDL_free(pool);
+}
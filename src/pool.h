@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2024-2025 Oxoboo
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE
+ * AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "SDL_atomic.h"
+#include "SDL_mutex.h"
+#include "SDL_thread.h"
+
+enum {
+    POOL_MAX_THREADS = 8,
+};
+
+/* Work on task `task` of a job on worker `worker`, see pool_start. */
+typedef void (*pool_task_t)(void* data, uint32_t worker, uint32_t task);
+
+typedef struct pool pool_t;
+
+typedef struct {
+    pool_t* pool;
+    uint32_t index;
+} pool_worker_t;
+
+/* A fixed set of threads that share the tasks of one job at a time. */
+struct pool {
+    SDL_Thread* threads[POOL_MAX_THREADS];
+    pool_worker_t workers[POOL_MAX_THREADS];
+    uint32_t num_threads;
+    SDL_sem* start;
+    SDL_sem* done;
+    SDL_atomic_t next_task;
+    SDL_atomic_t quit;
+    pool_task_t task;
+    void* data;
+    uint32_t num_tasks;
+};
+
+pool_t* pool_new(uint32_t num_threads);
+void    pool_start(pool_t* pool, pool_task_t task, void* data, uint32_t num_tasks);
+bool    pool_work_one(pool_t* pool);
+void    pool_wait(pool_t* pool);
+void    pool_cancel(pool_t* pool);
+void    pool_run(pool_t* pool, pool_task_t task, void* data, uint32_t num_tasks);
+void    pool_free(pool_t* pool);
+
+#endif /* POOL_H */
@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2024-2025 Oxoboo
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE
+ * AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/* mmap and friends are POSIX, not C99 */
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SDL_filesystem.h"
+#include "SDL_stdinc.h"
+#include "surface.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char surface_magic[4] = { 'T', 'S', 'S', 'T' };
+
+/*
+ * Return the number of surface signatures of a matrix with `cols` columns, where neighbouring
+ * columns differ by at most `max_delta` rows, or 0 if a table for them would be too large.
+ */
+uint32_t surface_num_signatures(uint32_t cols, uint32_t max_delta) {
+    uint64_t base = 2 * (uint64_t)max_delta + 1;
+    uint64_t count = 1;
+    for (uint32_t c = 1; c < cols; ++c) {
+        count *= base;
+        if (count > UINT32_MAX / NUM_PIECES) {
+            return 0;
+        }
+    }
+    return cols > 0 ? count : 0;
+}
+
+/*
+ * Find the surface signature of `matrix`. Return false if the matrix has holes or full rows, or if
+ * two neighbouring columns differ by more than `max_delta` rows, in which case the table can not
+ * be used.
+ */
+bool surface_signature(const matrix_t* matrix, uint32_t max_delta, uint32_t* signature) {
+    uint32_t under_tops = 0;
+    uint32_t lowest = UINT32_MAX;
+    for (uint32_t c = 0; c < matrix->cols; ++c) {
+        uint32_t height = matrix_col_height(matrix, c);
+        under_tops += height;
+        if (height < lowest) {
+            lowest = height;
+        }
+    }
+    /* without holes, a full row would mean that every column has a block in the bottom row */
+    if (under_tops != matrix_cell_count(matrix) || lowest != 0) {
+        return false;
+    }
+    uint32_t base = 2 * max_delta + 1;
+    uint32_t value = 0;
+    for (uint32_t c = matrix->cols - 1; c >= 1; --c) {
+        int32_t delta = (int32_t)matrix_col_height(matrix, c)
+                        - (int32_t)matrix_col_height(matrix, c - 1);
+        if (delta < -(int32_t)max_delta || delta > (int32_t)max_delta) {
+            return false;
+        }
+        value = value * base + (uint32_t)(delta + (int32_t)max_delta);
+    }
+    *signature = value;
+    return true;
+}
+
+/*
+ * Rebuild the column heights of the board with surface signature `signature`, whose lowest column
+ * is empty. Return false if the stack would not fit in `rows` rows.
+ */
+bool surface_heights(uint32_t signature, uint32_t rows, uint32_t cols, uint32_t max_delta,
+                     uint8_t* heights) {
+    uint32_t base = 2 * max_delta + 1;
+    int32_t tmp_heights[MATRIX_MAX_COLS];
+    int32_t lowest = 0;
+    tmp_heights[0] = 0;
+    for (uint32_t c = 1; c < cols; ++c) {
+        tmp_heights[c] = tmp_heights[c - 1] + (int32_t)(signature % base) - (int32_t)max_delta;
+        signature /= base;
+        if (tmp_heights[c] < lowest) {
+            lowest = tmp_heights[c];
+        }
+    }
+    for (uint32_t c = 0; c < cols; ++c) {
+        if (tmp_heights[c] - lowest > (int32_t)rows) {
+            return false;
+        }
+        heights[c] = tmp_heights[c] - lowest;
+    }
+    return true;
+}
+
+/* Return the table entry for a placement, or SURFACE_NONE if it can not be stored in one byte. */
+uint8_t surface_pack(const piece_t* piece) {
+    int32_t col = piece->x + SURFACE_X_OFFSET;
+    if (col < 0 || col > 0xF || piece->orient_index >= 0xF) {
+        return SURFACE_NONE;
+    }
+    return (uint8_t)((piece->orient_index << 4) | col);
+}
+
+/*
+ * Set up the header of a table for matrices like `matrix`, made by a bot with fingerprint
+ * `fingerprint` (see bot_fingerprint).
+ */
+void surface_header_init(surface_header_t* header, const matrix_t* matrix, uint32_t max_delta,
+                         uint32_t fingerprint) {
+    memcpy(header->magic, surface_magic, sizeof(header->magic));
+    header->version = SURFACE_VERSION;
+    header->rows = matrix->rows;
+    header->cols = matrix->cols;
+    header->hidden_rows = matrix->hidden_rows;
+    header->max_delta = max_delta;
+    header->num_signatures = surface_num_signatures(matrix->cols, max_delta);
+    header->fingerprint = fingerprint;
+}
+
+#if defined(_WIN32)
+
+static bool surface_map(surface_table_t* table, const char* path) {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0 || (uint64_t)size.QuadPart > SIZE_MAX) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        CloseHandle(file);
+        return false;
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    table->file = file;
+    table->mapping = mapping;
+    table->view = view;
+    table->view_size = (size_t)size.QuadPart;
+    return true;
+}
+
+static void surface_unmap(surface_table_t* table) {
+    UnmapViewOfFile(table->view);
+    CloseHandle(table->mapping);
+    CloseHandle(table->file);
+}
+
+#else
+
+static bool surface_map(surface_table_t* table, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    void* view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    /* the mapping keeps the file open by itself */
+    close(fd);
+    if (view == MAP_FAILED) {
+        return false;
+    }
+    table->file = NULL;
+    table->mapping = NULL;
+    table->view = view;
+    table->view_size = (size_t)st.st_size;
+    return true;
+}
+
+static void surface_unmap(surface_table_t* table) {
+    munmap(table->view, table->view_size);
+}
+
+#endif
+
+/*
+ * Map the table file at `path` into memory, so only the pages that are looked at are read from
+ * disk. Return NULL if the file can not be mapped, was made for matrices of other dimensions, or
+ * was made by a bot whose fingerprint is not `fingerprint`, since its placements would then not
+ * be the ones the bot chooses.
+ */
+surface_table_t* surface_open(const char* path, const matrix_t* matrix, uint32_t fingerprint) {
+    surface_table_t* table = SDL_malloc(sizeof(surface_table_t));
+    if (!table) {
+        return NULL;
+    }
+    if (!surface_map(table, path)) {
+        SDL_free(table);
+        return NULL;
+    }
+    bool valid = table->view_size >= sizeof(surface_header_t);
+    if (valid) {
+        memcpy(&table->header, table->view, sizeof(surface_header_t));
+        surface_header_t expected;
+        surface_header_init(&expected, matrix, table->header.max_delta, fingerprint);
+        uint64_t size = sizeof(surface_header_t) + (uint64_t)NUM_PIECES * expected.num_signatures;
+        valid = memcmp(&table->header, &expected, sizeof(surface_header_t)) == 0
+                && expected.num_signatures > 0 && table->view_size >= size;
+    }
+    if (!valid) {
+        surface_unmap(table);
+        SDL_free(table);
+        return NULL;
+    }
+    table->entries = (const uint8_t*)table->view + sizeof(surface_header_t);
+    return table;
+}
+
+/* Open SURFACE_FILE_NAME in the directory of the program, see surface_open. */
+surface_table_t* surface_open_default(const matrix_t* matrix, uint32_t fingerprint) {
+    char* base = SDL_GetBasePath();
+    if (!base) {
+        return NULL;
+    }
+    size_t size = strlen(base) + sizeof(SURFACE_FILE_NAME);
+    char* path = SDL_malloc(size);
+    surface_table_t* table = NULL;
+    if (path) {
+        snprintf(path, size, "%s%s", base, SURFACE_FILE_NAME);
+        table = surface_open(path, matrix, fingerprint);
+        SDL_free(path);
+    }
+    SDL_free(base);
+    return table;
+}
+
+/*
+ * Set up `piece` as the placement the table holds for a piece of type `type` on `matrix`. Return
+ * false if there is no table, or if the table can not be used for this matrix (see
+ * surface_signature) or has no placement for it. Then the placement has to be searched for.
+ */
+bool surface_lookup(const surface_table_t* table, const matrix_t* matrix, uint8_t type,
+                    piece_t* piece) {
+    uint32_t signature;
+    if (!table || type < 1 || type > NUM_PIECES
+        || !surface_signature(matrix, table->header.max_delta, &signature)) {
+        return false;
+    }
+    uint8_t entry = table->entries[(size_t)(type - 1) * table->header.num_signatures + signature];
+    if (entry == SURFACE_NONE || !piece_init(piece, matrix, type)) {
+        return false;
+    }
+    piece->orient_index = entry >> 4;
+    piece->x = (int32_t)(entry & 0xF) - SURFACE_X_OFFSET;
+    if (piece->orient_index >= piece->orientations || piece_collides(piece, matrix)) {
+        return false;
+    }
+    piece_hard_drop(piece, matrix);
+    return true;
+}
+
+void surface_close(surface_table_t* table) {
+    if (!table) {
+        return;
+    }
+    surface_unmap(table);
+    SDL_free(table);
+}
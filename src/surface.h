@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2024-2025 Oxoboo
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE
+ * AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef SURFACE_H
+#define SURFACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "matrix.h"
+
+/*
+ * A table of the placements bot_find_place chooses on stacks without holes, made ahead of time by
+ * tools/surfacegen.c. A cleaned stack without holes is the same as its column heights, and its
+ * lowest column is empty, so the differences between neighbouring columns (the surface
+ * signature) are enough to rebuild the whole board. Each entry is one byte: the orientation in
+ * the high four bits and the column of the piece plus SURFACE_X_OFFSET in the low four bits, or
+ * SURFACE_NONE if the table has no placement for the signature.
+ */
+/* looked for next to the program, see surface_open_default */
+#define SURFACE_FILE_NAME "surface.bin"
+
+enum {
+    SURFACE_VERSION = 2,
+    SURFACE_DEFAULT_MAX_DELTA = 2,
+    SURFACE_X_OFFSET = 3, /* a piece's box can stick out past the left wall by this much */
+    SURFACE_NONE = 0xFF,
+};
+
+/* Start of a table file, followed by NUM_PIECES arrays of `num_signatures` entries. */
+typedef struct {
+    char magic[4]; /* "TSST" */
+    uint32_t version;
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t hidden_rows;
+    uint32_t max_delta; /* largest difference between neighbouring columns in the table */
+    uint32_t num_signatures;
+    uint32_t fingerprint; /* of the bot that chose the placements, see bot_fingerprint */
+} surface_header_t;
+
+/* A table file mapped into memory, see surface_open. */
+typedef struct {
+    surface_header_t header;
+    const uint8_t* entries;
+    void* view; /* start of the mapping */
+    size_t view_size;
+    void* file; /* handles kept open on Windows */
+    void* mapping;
+} surface_table_t;
+
+uint32_t surface_num_signatures(uint32_t cols, uint32_t max_delta);
+bool     surface_signature(const matrix_t* matrix, uint32_t max_delta, uint32_t* signature);
+bool     surface_heights(uint32_t signature, uint32_t rows, uint32_t cols, uint32_t max_delta,
+                         uint8_t* heights);
+uint8_t  surface_pack(const piece_t* piece);
+void     surface_header_init(surface_header_t* header, const matrix_t* matrix,
+                             uint32_t max_delta, uint32_t fingerprint);
+surface_table_t* surface_open(const char* path, const matrix_t* matrix, uint32_t fingerprint);
+surface_table_t* surface_open_default(const matrix_t* matrix, uint32_t fingerprint);
+bool     surface_lookup(const surface_table_t* table, const matrix_t* matrix, uint8_t type,
+                        piece_t* piece);
+void     surface_close(surface_table_t* table);
+
+#endif /* SURFACE_H */
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2024-2025 Oxoboo
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE
+ * AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Make the table of placements that the bot looks up on stacks without holes (see surface.h).
+ * Every surface signature is turned back into a board, and bot_find_place searches every piece
+ * type on it like it would in the game. Run with `make surface`, or as
+ *
+ *     surfacegen <output file> [largest difference between neighbouring columns]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "SDL.h"
+#include "matrix.h"
+#include "bot.h"
+#include "pool.h"
+#include "surface.h"
+#include "errorvalues.h"
+
+enum {
+    SURFACEGEN_CHUNK = 4096, /* signatures in one task */
+};
+
+typedef struct {
+    bot_t* bots[POOL_MAX_THREADS + 1]; /* one for each worker */
+    matrix_t boards[POOL_MAX_THREADS + 1];
+    uint8_t* entries;
+    uint32_t num_signatures;
+    uint32_t max_delta;
+    int32_t err_value[POOL_MAX_THREADS + 1];
+} surfacegen_job_t;
+
+/*
+ * Return whether bot_update_inputs takes a piece from spawn to the destination of `bot` when it
+ * has no path to follow, like it does with a placement from the table. The game has no gravity:
+ * a piece only moves down when the bot asks for it (see main_loop), so following the inputs one
+ * at a time is all the game does. A move that fails would make the game drop the piece where it
+ * is, so such a placement is left out of the table.
+ */
+static bool surfacegen_reachable(bot_t* bot, const matrix_t* board, uint8_t type) {
+    bot->path_len = 0;
+    bot->path_states[0] = UINT16_MAX;
+    piece_t piece;
+    piece_init(&piece, board, type);
+    if (piece_collides(&piece, board)) {
+        return false;
+    }
+    for (uint32_t moves = 0; moves < MOVEGEN_MAX_STATES; ++moves) {
+        inputs_t inputs;
+        bot_update_inputs(bot, &inputs, &piece);
+        bool moved;
+        if (inputs.cw) {
+            moved = piece_rotate_cw(&piece, board);
+        } else if (inputs.ccw) {
+            moved = piece_rotate_ccw(&piece, board);
+        } else if (inputs.left) {
+            moved = piece_move_left(&piece, board);
+        } else if (inputs.right) {
+            moved = piece_move_right(&piece, board);
+        } else if (!piece_move_down(&piece, board)) {
+            return piece.orient_index == bot->dest_orient_index && piece.x == bot->dest_x
+                   && piece.y == bot->dest_y;
+        } else {
+            moved = true;
+        }
+        if (!moved) {
+            return false;
+        }
+    }
+    return false;
+}
+
+/*
+ * Return the table entry for the best placement of a piece type on `board`, or SURFACE_NONE if
+ * there is none or the bot could not get the piece there from the entry alone.
+ */
+static uint8_t surfacegen_entry(bot_t* bot, const matrix_t* board, uint8_t type,
+                                int32_t* err_value) {
+    int32_t tmp_err_value = bot_find_place(bot, board, type);
+    if (tmp_err_value != 0) {
+        *err_value = tmp_err_value;
+        return SURFACE_NONE;
+    }
+    if (bot->holes == UINT32_MAX) {
+        return SURFACE_NONE;
+    }
+    piece_t piece;
+    piece_init(&piece, board, type);
+    piece.orient_index = bot->dest_orient_index;
+    piece.x = bot->dest_x;
+    piece.y = bot->dest_y;
+    uint8_t entry = surface_pack(&piece);
+    if (entry == SURFACE_NONE || !surfacegen_reachable(bot, board, type)) {
+        return SURFACE_NONE;
+    }
+    /* surface_lookup drops the piece straight down from spawn, so check that it ends up there */
+    piece_t dropped;
+    piece_init(&dropped, board, type);
+    dropped.orient_index = piece.orient_index;
+    dropped.x = piece.x;
+    if (piece_collides(&dropped, board)) {
+        return SURFACE_NONE;
+    }
+    piece_hard_drop(&dropped, board);
+    return dropped.y == piece.y ? entry : SURFACE_NONE;
+}
+
+static void surfacegen_task(void* data, uint32_t worker, uint32_t task) {
+    surfacegen_job_t* job = data;
+    bot_t* bot = job->bots[worker];
+    matrix_t* board = &job->boards[worker];
+    uint32_t first = task * SURFACEGEN_CHUNK;
+    uint32_t last = first + SURFACEGEN_CHUNK;
+    if (last > job->num_signatures) {
+        last = job->num_signatures;
+    }
+    for (uint32_t signature = first; signature < last; ++signature) {
+        uint8_t heights[MATRIX_MAX_COLS];
+        bool fits = surface_heights(signature, board->rows, board->cols, job->max_delta, heights);
+        if (fits) {
+            matrix_fill(board, heights, TYPE_O);
+        }
+        for (uint8_t type = 1; type <= NUM_PIECES; ++type) {
+            uint8_t* entry = &job->entries[(size_t)(type - 1) * job->num_signatures + signature];
+            *entry = fits ? surfacegen_entry(bot, board, type, &job->err_value[worker])
+                          : SURFACE_NONE;
+        }
+    }
+    /* the boards never repeat, so remembering them only takes time */
+    bot_clear_cache(bot);
+}
+
+/* Fill `entries` for every signature on all threads. Return 0 on success. */
+static int32_t surfacegen_run(const matrix_t* matrix, uint32_t max_delta, uint8_t* entries,
+                              uint32_t num_signatures) {
+    int32_t cpus = SDL_GetCPUCount();
+    uint32_t num_threads = cpus > 1 ? cpus - 1 : 0;
+    if (num_threads > POOL_MAX_THREADS) {
+        num_threads = POOL_MAX_THREADS;
+    }
+    pool_t* pool = num_threads > 0 ? pool_new(num_threads) : NULL;
+    if (!pool) {
+        num_threads = 0;
+    }
+    surfacegen_job_t job;
+    job.entries = entries;
+    job.num_signatures = num_signatures;
+    job.max_delta = max_delta;
+    int32_t err_value = 0;
+    for (uint32_t i = 0; i <= num_threads; ++i) {
+        job.bots[i] = bot_new(matrix);
+        job.err_value[i] = 0;
+        matrix_init(&job.boards[i], matrix->rows, matrix->cols, matrix->hidden_rows);
+        if (!job.bots[i]) {
+            err_value = ERROR_BOT;
+        }
+    }
+    if (err_value == 0) {
+        uint32_t num_tasks = (num_signatures + SURFACEGEN_CHUNK - 1) / SURFACEGEN_CHUNK;
+        if (pool) {
+            pool_run(pool, surfacegen_task, &job, num_tasks);
+        } else {
+            for (uint32_t task = 0; task < num_tasks; ++task) {
+                surfacegen_task(&job, 0, task);
+            }
+        }
+    }
+    for (uint32_t i = 0; i <= num_threads; ++i) {
+        err_value = err_value != 0 ? err_value : job.err_value[i];
+        bot_free(job.bots[i]);
+    }
+    pool_free(pool);
+    return err_value;
+}
+
+int32_t main(int32_t argc, char **argv) {
+    if (argc < 2) {
+        printf("usage: %s <output file> [max delta]\n", argv[0]);
+        return ERROR_FEW_ARGUMENTS;
+    }
+    uint32_t max_delta = argc > 2 ? strtoul(argv[2], NULL, 10) : SURFACE_DEFAULT_MAX_DELTA;
+    matrix_t* matrix = matrix_new(MATRIX_ROWS, MATRIX_COLS, MATRIX_HIDDEN_ROWS);
+    if (!matrix) {
+        return ERROR_MATRIX;
+    }
+    bot_t* bot = bot_new(matrix);
+    if (!bot) {
+        matrix_free(matrix);
+        return ERROR_BOT;
+    }
+    uint32_t fingerprint;
+    int32_t tmp_err_value = bot_fingerprint(bot, &fingerprint);
+    bot_free(bot);
+    if (tmp_err_value != 0) {
+        matrix_free(matrix);
+        return tmp_err_value;
+    }
+    surface_header_t header;
+    surface_header_init(&header, matrix, max_delta, fingerprint);
+    if (header.num_signatures == 0) {
+        printf("max delta %u makes too many signatures\n", (unsigned)max_delta);
+        matrix_free(matrix);
+        return ERROR_UNKNOWN_ARGUMENT;
+    }
+    uint8_t* entries = malloc((size_t)NUM_PIECES * header.num_signatures);
+    if (!entries) {
+        matrix_free(matrix);
+        return ERROR_SURFACE;
+    }
+    uint64_t start = SDL_GetPerformanceCounter();
+    int32_t err_value = surfacegen_run(matrix, max_delta, entries, header.num_signatures);
+    if (err_value == 0) {
+        FILE* file = fopen(argv[1], "wb");
+        bool written = file
+                       && fwrite(&header, sizeof(header), 1, file) == 1
+                       && fwrite(entries, NUM_PIECES, header.num_signatures, file)
+                          == header.num_signatures;
+        if (file && fclose(file) != 0) {
+            written = false;
+        }
+        if (!written) {
+            printf("could not write %s\n", argv[1]);
+            err_value = ERROR_SURFACE_WRITE;
+        }
+    }
+    if (err_value == 0) {
+        uint32_t found = 0;
+        for (size_t i = 0; i < (size_t)NUM_PIECES * header.num_signatures; ++i) {
+            found += entries[i] != SURFACE_NONE;
+        }
+        printf("%u signatures, %u of %u placements stored in %.1f s\n",
+               (unsigned)header.num_signatures, (unsigned)found,
+               (unsigned)(NUM_PIECES * header.num_signatures),
+               (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency());
+    } else {
+        printf("Error value: %d\n", err_value);
+    }
+    free(entries);
+    matrix_free(matrix);
+    return err_value;
+}